@@ -0,0 +1,227 @@
+// Only built with UART_BENCH, see bench.h
+#ifdef UART_BENCH
+
+#include "44b.h"
+#include "uart.h"
+#include "clock.h"
+#include "bench.h"
+
+// Bytes sent on each run, keep it under 4096 so that
+// bytes * 1000000 fits in 32 bits
+#ifndef BENCH_LEN
+#define BENCH_LEN 1024
+#endif
+
+// Baud rate used on the link while benchmarking
+#ifndef BENCH_BAUD
+#define BENCH_BAUD 115200
+#endif
+
+// Bytes in flight on the loopback runs
+#define BENCH_CHUNK 64
+
+// Give up a loopback run after this many microseconds without progress
+#define BENCH_TIMEOUT_US 100000
+
+// Backstop for the timeout above, in polls without progress, in case
+// the clock isn't running
+#define BENCH_MAX_POLLS 10000000
+
+// Polls to wait for the clock to go past two TIMER5 reloads
+#define BENCH_CLOCK_POLLS 1000000
+
+typedef char bench_len_check[(BENCH_LEN < 4096) ? 1 : -1];
+
+// Transfer modes under test
+struct bench_mode {
+    char *name;
+    enum URxTxMode rxmode;
+    enum URxTxMode txmode;
+    enum ONOFF fifo;
+};
+
+static struct bench_mode modes[] = {
+    {"POLL", POLL, POLL, OFF},
+    {"INT", INT, INT, OFF},
+    {"FIFO", INT, INT, ON},
+    {"DMA-TX", INT, DMA, OFF},
+    {"DMA-RX", DMA, INT, OFF},
+};
+
+#define NMODES ((int) (sizeof(modes) / sizeof(modes[0])))
+
+static char txdata[BENCH_LEN];
+static char rxdata[BENCH_CHUNK];
+
+// Clock ticks, the low 32 bits are enough for a run
+static unsigned int bench_now(void) {
+    return (unsigned int) clock_now_ticks();
+}
+
+// Bytes per second, given the ticks it took to move `len` bytes
+static unsigned int bench_rate(int len, unsigned int ticks) {
+    unsigned int us = ticks >> CLOCK_US_SHIFT;
+
+    if (us == 0) {
+        return 0;
+    }
+
+    return (len * 1000000u) / us;
+}
+
+// Check that the clock keeps counting across TIMER5 reloads
+// Without it, throughput and timeouts would be meaningless.
+static int bench_clock_ok(void) {
+    int i;
+    unsigned int start = bench_now();
+
+    for (i = 0; i < BENCH_CLOCK_POLLS; i++) {
+        if (bench_now() - start > 0x20000) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Send BENCH_LEN bytes and wait until they have left the port
+static unsigned int bench_tx(enum UART link) {
+    unsigned int start = bench_now();
+
+    uart_write_async(link, txdata, BENCH_LEN);
+    uart_flush(link);
+
+    return bench_now() - start;
+}
+
+// Send BENCH_LEN bytes through the loopback, reading them back
+// as they arrive. Keep at most `chunk` bytes in flight so the
+// receiver is never overrun. Mismatched bytes are counted on `errors`.
+// Returns the ticks it took, or 0 on timeout.
+static unsigned int bench_loop(enum UART link, int chunk, int *errors) {
+    int i;
+    int n;
+    int sent = 0;
+    int recvd = 0;
+    int polls = 0;
+    unsigned int start = bench_now();
+    unsigned int progress = start;
+
+    *errors = 0;
+
+    while (recvd < BENCH_LEN) {
+        if (sent < BENCH_LEN && sent - recvd < chunk) {
+            n = chunk - (sent - recvd);
+            if (n > BENCH_LEN - sent) {
+                n = BENCH_LEN - sent;
+            }
+            uart_write_async(link, &txdata[sent], n);
+            sent += n;
+        }
+
+        n = uart_getbuf(link, rxdata, BENCH_CHUNK);
+        for (i = 0; i < n; i++) {
+            if (rxdata[i] != txdata[recvd + i]) {
+                (*errors)++;
+            }
+        }
+        recvd += n;
+
+        if (n > 0) {
+            progress = bench_now();
+            polls = 0;
+        } else if (bench_now() - progress > BENCH_TIMEOUT_US * (CLOCK_HZ / 1000000) ||
+                   ++polls > BENCH_MAX_POLLS) {
+            *errors += BENCH_LEN - recvd;
+            return 0;
+        }
+    }
+
+    return bench_now() - start;
+}
+
+// Print the ISR costs gathered on the last run
+static void bench_print_isr(enum UART console, char *name, struct uisrstats *st) {
+    unsigned int avg = (st->calls > 0) ? st->ticks / st->calls : 0;
+
+    uart_printf(console, "  %s isr: %u calls, %u bytes, avg %u ticks, worst %u\n",
+                name, st->calls, st->bytes, avg, st->worst);
+}
+
+// Run every transfer mode on `link`, in loopback, and print the
+// results on `console`. `link` is left configured with `lconf`,
+// on INTerrupt mode.
+// Returns the mismatched or lost bytes over all the runs, or -1 if
+// the clock isn't running.
+int bench_run(enum UART console, enum UART link, struct ulconf *lconf) {
+    int i;
+    int errors;
+    int total = 0;
+    int chunk;
+    unsigned int txticks;
+    unsigned int rxticks;
+    struct ulconf conf = *lconf;
+    struct uisrstats rxst;
+    struct uisrstats txst;
+
+    for (i = 0; i < BENCH_LEN; i++) {
+        txdata[i] = (char) (i * 7 + 1);
+    }
+
+    conf.echo = OFF;
+    conf.canon = OFF;
+    conf.afc = OFF;
+    conf.baud = BENCH_BAUD;
+
+    if (!bench_clock_ok()) {
+        uart_printf(console, "\nUART bench: clock not running, skipped\n");
+        return -1;
+    }
+
+    uart_printf(console, "\nUART bench: %d bytes at %d baud, %d ticks/us\n",
+                BENCH_LEN, BENCH_BAUD, CLOCK_HZ / 1000000);
+
+    for (i = 0; i < NMODES; i++) {
+        conf.fifo = modes[i].fifo;
+
+        uart_conf_rxmode(link, DIS);
+        uart_conf_txmode(link, DIS);
+        uart_lconf(link, &conf);
+        uart_loopback(link, ON);
+
+        // Tx only, nobody listening
+        uart_conf_txmode(link, modes[i].txmode);
+        uart_isrstats(link, &rxst, &txst, ON);
+        txticks = bench_tx(link);
+
+        // Loopback, one byte at a time if the receiver can't buffer them
+        uart_conf_rxmode(link, modes[i].rxmode);
+        chunk = BENCH_CHUNK;
+        if (modes[i].rxmode == POLL) {
+            chunk = (modes[i].fifo == ON) ? 16 : 1;
+        }
+        uart_isrstats(link, &rxst, &txst, ON);
+        rxticks = bench_loop(link, chunk, &errors);
+        uart_isrstats(link, &rxst, &txst, ON);
+        total += errors;
+
+        uart_printf(console, "%-6s tx %u B/s, loopback %u B/s, %d errors\n",
+                    modes[i].name, bench_rate(BENCH_LEN, txticks),
+                    bench_rate(BENCH_LEN, rxticks), errors);
+        bench_print_isr(console, "rx", &rxst);
+        bench_print_isr(console, "tx", &txst);
+    }
+
+    uart_printf(console, "Worst IRQ latency: %u ticks\n", clock_irq_latency());
+
+    uart_conf_rxmode(link, DIS);
+    uart_conf_txmode(link, DIS);
+    uart_loopback(link, OFF);
+    uart_lconf(link, lconf);
+    uart_conf_rxmode(link, INT);
+    uart_conf_txmode(link, INT);
+
+    return total;
+}
+
+#endif
@@ -0,0 +1,10 @@
+// UART benchmark, only built with UART_BENCH
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include "uart.h"
+
+int bench_run(enum UART console, enum UART link, struct ulconf *lconf);
+
+#endif
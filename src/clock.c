@@ -0,0 +1,90 @@
+#include "44b.h"
+#include "intcontroller.h"
+#include "timer.h"
+#include "clock.h"
+
+// TIMER5 period, it wraps every 65536 ticks (~2ms)
+// The count is CLOCK_PERIOD - 1 (see timer.h)
+#define CLOCK_PERIOD 0x10000
+
+// TIMER5 reloads, the high bits of the clock
+static volatile unsigned int overflows;
+// Worst time between a TIMER5 reload and its ISR running
+static volatile unsigned int latency;
+
+void Clock_TimerInt(void) __attribute__ ((interrupt ("IRQ")));
+
+// TIMER5 ISR, raised when the counter reaches 0 and reloads
+void Clock_TimerInt(void) {
+    unsigned int elapsed = (CLOCK_PERIOD - 1) - clock_stamp();
+
+    overflows++;
+    if (elapsed > latency) {
+        latency = elapsed;
+    }
+
+    ic_cleanflag(INT_TIMER5);
+}
+
+// Start TIMER5 as a free running down counter at MCLK / 2
+// Uses prescaler 2, so TIMER4 shares the same prescaler value (0)
+// Should be called after ic_init
+int clock_init(void) {
+    struct tmr_txn tx;
+
+    overflows = 0;
+    latency = 0;
+
+    tmr_stop(TIMER5);
+
+    tmr_txn_begin(&tx);
+    if (tmr_txn_prescaler(&tx, 2, 0) != 0 ||
+        tmr_txn_divider(&tx, 5, D1_2) != 0 ||
+        tmr_txn_count(&tx, TIMER5, CLOCK_PERIOD - 1, 0) != 0 ||
+        tmr_txn_mode(&tx, TIMER5, RELOAD) != 0 ||
+        tmr_txn_start(&tx, TIMER5) != 0) {
+        return -1;
+    }
+
+    pISR_TIMER5 = (int) Clock_TimerInt;
+    ic_conf_line(INT_TIMER5, IRQ);
+    ic_enable(INT_TIMER5);
+
+    tmr_txn_commit(&tx);
+    return 0;
+}
+
+// Ticks (1/CLOCK_HZ s) since clock_init
+// Safe to call with interrupts enabled or from another ISR
+unsigned long long clock_now_ticks(void) {
+    unsigned int high;
+    unsigned int low;
+    unsigned int pending;
+
+    // Re-read if the ISR ran while we were looking at the counter
+    do {
+        high = overflows;
+        low = clock_stamp();
+        pending = rINTPND & INT_BIT(INT_TIMER5);
+    } while (high != overflows);
+
+    // A reload the ISR has not accounted for yet (we are inside
+    // another ISR, or it's about to run). If the counter is on its
+    // upper half, it was read after that reload (this holds as long
+    // as interrupts are never held off for more than ~1ms).
+    if (pending && low >= CLOCK_PERIOD / 2) {
+        high++;
+    }
+
+    return ((unsigned long long) high << 16) + ((CLOCK_PERIOD - 1) - low);
+}
+
+// Microseconds since clock_init
+unsigned long long clock_now_us(void) {
+    return clock_now_ticks() >> CLOCK_US_SHIFT;
+}
+
+// Worst delay seen between a TIMER5 reload and its ISR, in ticks
+unsigned int clock_irq_latency(void) {
+    return latency;
+}
@@ -0,0 +1,29 @@
+// Monotonic clock on TIMER5
+//
+// TIMER5 wraps every 65536 ticks (~2ms), and the ISR counts the wraps.
+// No ISR may run (nor interrupts stay disabled) for longer than that,
+// or a wrap is lost and the clock falls 65536 ticks behind for good.
+// clock_now_ticks() called from an ISR is only right within ~1ms of a
+// wrap. So no busy-waits (Delay) in ISRs: defer to the timer wheel.
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include "44b.h"
+
+// TIMER5 counts at MCLK / 2 (32 MHz), 1us is 32 ticks
+#define CLOCK_HZ ((MCLK) / 2)
+#define CLOCK_US_SHIFT 5
+
+// Raw TIMER5 count, cheap enough for ISRs to time themselves
+// It counts down, so elapsed ticks are (start - end) & 0xFFFF
+static inline unsigned int clock_stamp(void) {
+    return rTCNTO5 & 0xFFFF;
+}
+
+int clock_init(void);
+unsigned long long clock_now_ticks(void);
+unsigned long long clock_now_us(void);
+unsigned int clock_irq_latency(void);
+
+#endif
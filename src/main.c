@@ -9,22 +9,31 @@
 #include "keyboard.h"
 #include "ring.h"
 #include "uart.h"
+#include "uframe.h"
+#include "wheel.h"
+#include "clock.h"
+#include "sleep.h"
+
+#ifdef UART_BENCH
+#include "bench.h"
+#endif
 
 // Pin macros
 #define KB_PIN 1
 #define BUF_SIZE 4
 #define READLINE_BUF_SIZE 128
+#define FRAME_BUF_SIZE 256
 
-// Timer helper methods
-enum tmr_seconds {
-    TWO_SECS = 0,
-    ONE_SEC = 1,
-    HALF_SEC = 2,
-    QUARTER_SEC = 3
-};
+// UART0 is the operator console, UART1 the data link
+#define CONSOLE UART0
+#define DATALINK UART1
+
+// Data link commands (first byte of a frame)
+// Any other frame is sent back as is
+#define DL_STATUS 'S'
 
-// Default timer CMP register value
-#define TMR_CMP 1
+// Display step period (1s)
+#define SHOW_PERIOD_NS 1000000000u
 
 //  UART configuration
 struct ulconf uconf = {
@@ -33,7 +42,25 @@ struct ulconf uconf = {
     .stopb = ONE,
     .wordlen = EIGHT,
     .echo = ON,
-    .baud = 115200
+    .baud = 115200,
+    .fifo = ON,
+    .rxtrig = RXTRIG8,
+    .txtrig = TXTRIG4,
+    .canon = ON
+};
+
+// Data link configuration, carries binary frames
+struct ulconf dlconf = {
+    .ired = OFF,
+    .par = NONE,
+    .stopb = ONE,
+    .wordlen = EIGHT,
+    .echo = OFF,
+    .baud = 115200,
+    .fifo = ON,
+    .rxtrig = RXTRIG8,
+    .txtrig = TXTRIG4,
+    .canon = OFF
 };
 
 // FSM state
@@ -55,6 +82,10 @@ static char guess_buf[BUF_SIZE];
 // Buffer holding the line input from uart
 char readline_buffer[READLINE_BUF_SIZE];
 
+// Receive state and buffer for the data link frames
+static unsigned char frame_buffer[FRAME_BUF_SIZE];
+static struct uframe_rx frame_rx;
+
 // Ring buffer and its backing buffer holding the data from user
 static char backing_buffer[BUF_SIZE];
 static struct ring_t ring_buffer;
@@ -63,6 +94,23 @@ static struct ring_t ring_buffer;
 // pressing keys
 volatile static int input_done = 0;
 
+// Keyboard debounce (see kb_debounce)
+// Before reading a key, and after releasing it
+#define KB_DEBOUNCE_MS 20
+// Key release polling period
+#define KB_POLL_MS 5
+
+enum kb_phase {
+    KB_PRESSED,
+    KB_HELD,
+    KB_RELEASED
+};
+
+static struct wheel_timer kb_timer;
+static enum kb_phase kb_phase;
+// Set when the key read was F, the last one
+static int kb_last = 0;
+
 // Show done is set to 1 from ISR when we're done showing
 // the user input
 volatile static int show_done = 0;
@@ -78,92 +126,6 @@ volatile static char* target_buffer = NULL;
 void timer_ISR(void) __attribute__ ((interrupt ("IRQ")));
 void keyboard_ISR(void) __attribute__ ((interrupt ("IRQ")));
 
-// XXX: To update mode and prescaler, do we need to restart?
-// Not really, but if we do so, the changes will be visible as soon as we update,
-// and not only on the next timer cycle.
-
-// Setup timer `t` with the given values
-int setup_timer(enum tmr_timer t,
-                int prescaler_value,
-                enum tmr_div div_value,
-                int timer_count,
-                enum tmr_mode mode) {
-
-
-    int prescaler_p;
-
-    // Divider is the same as the timer
-    int divider_p = (int) t;
-
-    // Set timer mode
-    if (tmr_set_mode(t, mode) != 0) {
-        return -1;
-    }
-
-    // Set count and cmp registers
-    if (tmr_set_count(t, timer_count, TMR_CMP) != 0) {
-        return -1;
-    }
-
-    // Set divider value
-    if (tmr_set_divider(divider_p, div_value) != 0) {
-        return -1;
-    }
-
-    // Which prescaler should we use?
-    // Prescaler are shared every two timers
-    if (t == TIMER0 || t == TIMER1) {
-        prescaler_p = 0;
-    } else if (t == TIMER2 || t == TIMER3) {
-        prescaler_p = 1;
-    } else if (t == TIMER4 || t == TIMER5) {
-        prescaler_p = 2;
-    } else {
-        return -1;
-    }
-
-    if (tmr_set_prescaler(prescaler_p, prescaler_value) != 0) {
-        return -1;
-    }
-
-    // Flush the buffer registers and force-update the timer
-    return tmr_update(t);
-}
-
-int set_timer_to(enum tmr_timer t, enum tmr_seconds seconds, enum tmr_mode mode) {
-    int timer_count;
-    int prescaler_value = 255;
-    enum tmr_div div_value;
-
-    // Valid second definition?
-    if (seconds < 0 || seconds > 3) {
-        return -1;
-    }
-
-    if (seconds == QUARTER_SEC) {
-        div_value = D1_4;
-    } else {
-        div_value = D1_8;
-    }
-
-    switch (seconds) {
-        case TWO_SECS:
-            timer_count = 62500;
-            break;
-        case ONE_SEC:
-            timer_count = 31250;
-            break;
-        case HALF_SEC: // Fall-through
-        case QUARTER_SEC:
-            timer_count = 15625;
-            break;
-        default:
-            return -1;
-    }
-
-    return setup_timer(t, prescaler_value, div_value, timer_count, mode);
-}
-
 // This ISR will keep printing data from the ring buffer
 // and moving it into the pointer denoted by target_buffer
 // It will also print the value on the 8-segment display
@@ -195,43 +157,91 @@ void timer_ISR(void) {
 
 // Will store user input on a ring buffer until the user presses the 'F' key.
 // At that point it will signal it by setting `input_done` to 1.
+// The key is debounced on the timer wheel (see kb_debounce), so this
+// ISR only masks the line and arms the debounce timer. Busy-waiting
+// here for ~40ms would hold every other interrupt off, and TIMER5
+// (the clock) wraps every ~2ms.
 void keyboard_ISR(void) {
+    // Masked until the key is released and debounced
+    ic_disable(INT_EINT1);
+
+    kb_phase = KB_PRESSED;
+    wheel_add(&kb_timer, WHEEL_MS(KB_DEBOUNCE_MS), 0);
+
+    // Clear pending interrupts on line EINT1
+    ic_cleanflag(INT_EINT1);
+}
+
+// Keyboard debounce, runs from the wheel (TIMER2 ISR)
+// KB_DEBOUNCE_MS after the press, read the key. Then poll the line
+// every KB_POLL_MS until the key is depressed, and wait KB_DEBOUNCE_MS
+// more before taking the next press.
+static void kb_debounce(void *arg) {
     int key;
-    int should_disable_interrupt = 0;
     enum digital key_state = LOW;
 
-    // Wait for debounce
-    Delay(200);
-
-    key = kb_scan();
-    if (key == -1) {
-        goto exit_kb_isr;
-    }
+    (void) arg;
+
+    switch (kb_phase) {
+        case KB_PRESSED:
+            key = kb_scan();
+            if (key == 0xF) {
+                // Signalled once the key is released, as before
+                kb_last = 1;
+            } else if (key != -1) {
+                // Will only store 4 keys, overwrite otherwise
+                ring_put(&ring_buffer, key);
+            }
 
-    // If key is F, signal end of user input, else store on ring
-    if (key == 0xF) {
-        should_disable_interrupt = 1;
-        input_done = 1;
-    } else {
-        // Will only store 4 keys, overwrite otherwise
-        ring_put(&ring_buffer, key);
-    }
+            kb_phase = KB_HELD;
+            wheel_add(&kb_timer, WHEEL_MS(KB_POLL_MS), 0);
+            break;
 
-exit_kb_isr:
+        case KB_HELD:
+            // Wait until key is depressed
+            portG_read(KB_PIN, &key_state);
+            if (key_state == LOW) {
+                wheel_add(&kb_timer, WHEEL_MS(KB_POLL_MS), 0);
+                break;
+            }
 
-    // Wait until key is depressed
-    do { portG_read(KB_PIN, &key_state); } while (key_state == LOW);
+            kb_phase = KB_RELEASED;
+            wheel_add(&kb_timer, WHEEL_MS(KB_DEBOUNCE_MS), 0);
+            break;
 
-    // Wait for debounce
-    Delay(200);
+        case KB_RELEASED:
+            // Drop the edges the bouncing left pending
+            ic_cleanflag(INT_EINT1);
 
-    // If this is the last key that should be read, disable interrupts
-    if (should_disable_interrupt == 1) {
-        ic_disable(INT_EINT1);
+            // If key is F, signal end of user input, and leave the line
+            // masked (read_user_input enables it again)
+            if (kb_last == 1) {
+                kb_last = 0;
+                input_done = 1;
+            } else {
+                ic_enable(INT_EINT1);
+            }
+            break;
     }
+}
 
-    // Clear pending interrupts on line EINT1
-    ic_cleanflag(INT_EINT1);
+// Serve any pending frame on the data link, without blocking
+// Called from every wait loop, so the data link keeps running
+// while the game waits on the operator.
+void service_datalink(void) {
+    int len;
+    unsigned char *frame;
+    unsigned char status[2];
+
+    while ((len = uframe_recv(&frame_rx, &frame)) > 0) {
+        if (frame[0] == DL_STATUS) {
+            status[0] = DL_STATUS;
+            status[1] = game_state;
+            uframe_send(DATALINK, status, 2);
+        } else {
+            uframe_send(DATALINK, frame, len);
+        }
+    }
 }
 
 // Reads user input into the ring buffer
@@ -248,32 +258,16 @@ int read_user_input() {
     ic_enable(INT_EINT1);
 
     // input_done will be 1 when the ISR reads the `F` key from the user
-    while(input_done == 0);
+    while(input_done == 0) {
+        service_datalink();
+        // Any interrupt (key, data link, timer tick) wakes us up
+        sleep_idle();
+    }
 
     // Return the number of keys read (size of the ring buffer)
     return ring_size(&ring_buffer);
 }
 
-int readline(char* buffer, int size) {
-    char data;
-    // Keeps track of bytes read from uart
-    int byte_count = 0;
-
-    if (size == 0) {
-        return 0;
-    }
-
-    // Read byte by byte from uart, until we reach size or read \r
-    do {
-        uart_getch(UART0, &data);
-        buffer[byte_count] = data;
-        // TODO(borja): Remember to set \r\n in termite
-        byte_count++;
-    } while ((byte_count != size) && (data != '\r'));
-
-    return byte_count;
-}
-
 // Print the contents of the buffer at 1 char/s
 // and push them into `target_buffer`
 void print_and_transfer(int watermark) {
@@ -283,7 +277,10 @@ void print_and_transfer(int watermark) {
     // Start the timer (will be stopped from ISR)
     tmr_start(TIMER0);
     // show_done will be 1 when the time ISR stops printing
-    while (show_done == 0);
+    while (show_done == 0) {
+        service_datalink();
+        sleep_idle();
+    }
 }
 
 void print_password() {
@@ -314,11 +311,11 @@ int check_show_result() {
 
     ring_reset(&ring_buffer);
     if (match == 1) {
-        uart_send_str(UART0, "\nCorrecto\n");
+        uart_send_str(CONSOLE, "\nCorrecto\n");
         ring_put(&ring_buffer, 0xA);
         ring_put(&ring_buffer, 0xA);
     } else {
-        uart_send_str(UART0, "\nError\n");
+        uart_send_str(CONSOLE, "\nError\n");
         ring_put(&ring_buffer, 0xE);
         ring_put(&ring_buffer, 0xE);
     }
@@ -350,7 +347,7 @@ int setup(void) {
     // ------------------------------------------------------------
     // Timer 0 configuration
     // ------------------------------------------------------------
-    set_timer_to(TIMER0, ONE_SEC, RELOAD);
+    tmr_set_period(TIMER0, SHOW_PERIOD_NS, RELOAD, NULL);
 
     // ------------------------------------------------------------
     // Set up ISR handlers
@@ -379,11 +376,25 @@ int setup(void) {
     ic_enable(INT_TIMER0);
     ic_disable(INT_EINT1);
 
+    // Software timers, ticked every 1ms by TIMER2
+    wheel_init();
+    wheel_timer_init(&kb_timer, kb_debounce, NULL);
+    // Monotonic clock on TIMER5
+    clock_init();
+    // Sleeps on TIMER4
+    sleep_init();
+
     // Setup uart controller
+    // Both ports run on INTerrupt mode, with their own rings
     uart_init();
-    uart_lconf(UART0, &uconf);
-    uart_conf_rxmode(UART0, INT);
-    uart_conf_txmode(UART0, INT);
+    uart_lconf(CONSOLE, &uconf);
+    uart_conf_rxmode(CONSOLE, INT);
+    uart_conf_txmode(CONSOLE, INT);
+
+    uart_lconf(DATALINK, &dlconf);
+    uart_conf_rxmode(DATALINK, INT);
+    uart_conf_txmode(DATALINK, INT);
+    uframe_rx_init(&frame_rx, DATALINK, frame_buffer, FRAME_BUF_SIZE);
 
     // Finally, unmask the global register
     // If disabled, no interrupt will be serviced, even
@@ -415,7 +426,7 @@ int loop(void) {
         case SHOW_PASS:
             print_password();
             // Only need the delay if timer doesn't wait on last iteration (watermark check done after print)
-            Delay(10000);
+            sleep_ms(1000);
             game_state = GUESS;
             break;
 
@@ -423,19 +434,23 @@ int loop(void) {
             // Guess input using UART
             // Send instruction to the user, then wait until user
             // fills the readline_buffer
-            uart_send_str(UART0, "Introduzca passwd: ");
+            uart_send_str(CONSOLE, "Introduzca passwd: ");
             D8Led_digit(0xF);
             do {
-                uart_bytes_read = readline(readline_buffer, READLINE_BUF_SIZE);
-                if (readline_buffer[uart_bytes_read-1] == '\r') {
-                    uart_bytes_read--;
+                // Keep the data link going until the user is done typing
+                while (uart_line_ready(CONSOLE) == 0) {
+                    service_datalink();
+                    sleep_idle();
                 }
 
+                // The line comes already edited, without terminator
+                uart_bytes_read = uart_readline(CONSOLE, readline_buffer, READLINE_BUF_SIZE);
+
                 // Only show if < 4, do it here otherwise
                 // we'll always do it no matter if the user was right
                 if (uart_bytes_read < 4) {
                     D8Led_digit(0xE);
-                    Delay(10000);
+                    sleep_ms(1000);
                 }
             } while (uart_bytes_read < 4);
 
@@ -457,7 +472,7 @@ int loop(void) {
         case SHOW_GUESS:
             print_guess();
             // Only need the delay if timer doesn't wait on last iteration (watermark check done after print)
-            Delay(10000);
+            sleep_ms(1000);
             game_state = GAME_OVER;
             break;
 
@@ -476,6 +491,10 @@ int loop(void) {
 
 int main(void) {
     setup();
+#ifdef UART_BENCH
+    // Loopback benchmark on the data link, results on the console
+    bench_run(CONSOLE, DATALINK, &dlconf);
+#endif
     while (1) {
         loop();
     }
@@ -0,0 +1,164 @@
+#include <stddef.h>
+#include "44b.h"
+#include "timer.h"
+#include "pwm.h"
+
+// Per output state
+struct pwm_out {
+    // Timer configuration found for the period
+    struct tperiod period;
+    // (ticks per period << 16) / 1000, so the duty cycle can be
+    // turned into a cmp value with a multiply and a shift
+    unsigned int scale;
+};
+
+static struct pwm_out pwm[5];
+
+// Set up timer `t` (0-4) to output a PWM signal with the given
+// period (or the closest one, copied into `res` if not NULL) on its
+// TOUTn pin, with a 0% duty cycle. The output is low for the
+// first part of the period and high from the cmp match until the
+// end (the other way around with `invert`).
+// The timer runs in RELOAD mode, and is left stopped (see pwm_start).
+// Returns -1 if the period can't be obtained, or the prescaler
+// is shared with a timer in use (configured, running or not)
+// that needs a different value.
+int pwm_init(enum tmr_timer t, unsigned int period_ns, enum enable invert,
+             struct tperiod *res) {
+    unsigned long long ticks;
+    struct pwm_out *out = &pwm[t];
+    struct tmr_txn tx;
+
+    // Timer 5 has no output pin
+    if (t < TIMER0 || t > TIMER4) {
+        return -1;
+    }
+
+    if (tmr_solve_period(t, period_ns, &out->period) != 0) {
+        return -1;
+    }
+
+    if (res != NULL) {
+        *res = out->period;
+    }
+
+    // The period is count + 1 ticks (see timer.h), up to 0x10000,
+    // which would overflow 32 bits once shifted. The scale itself is
+    // at most 2^32 / 1000, and 1000 * scale still fits.
+    ticks = (unsigned long long) out->period.count + 1;
+    out->scale = (unsigned int) (((ticks << 16) + 500) / 1000);
+
+    tmr_txn_begin(&tx);
+    if (tmr_txn_stop(&tx, t) != 0 ||
+        tmr_txn_period(&tx, t, &out->period) != 0 ||
+        tmr_txn_mode(&tx, t, RELOAD) != 0 ||
+        tmr_txn_inverter(&tx, t, invert) != 0) {
+        return -1;
+    }
+    tmr_txn_commit(&tx);
+
+    // TOUTn is the function 10 of pin PE(3 + n), rPCONE[7 + 2n:6 + 2n]
+    rPCONE = (rPCONE & ~(0x3 << (6 + 2 * t))) | (0x2 << (6 + 2 * t));
+
+    return 0;
+}
+
+// Set the duty cycle (high time, in thousandths) of the output
+// The cmp register is double-buffered, the new value is loaded on
+// the next reload, so the current period is never cut short.
+// No divisions, cheap enough to be called from an ISR on each period.
+// Both ends are a tick off: 0 still gives a one tick pulse (cmp 0
+// matches on the last tick), and 1000 leaves a one tick gap, since
+// cmp is clamped to count.
+int pwm_set_duty(enum tmr_timer t, unsigned int permille) {
+    unsigned int cmp;
+
+    if (t < TIMER0 || t > TIMER4) {
+        return -1;
+    }
+
+    if (permille > 1000) {
+        permille = 1000;
+    }
+
+    cmp = (permille * pwm[t].scale) >> 16;
+    // A full period would be count + 1, the most rTCMPBn can take is count
+    if (cmp > (unsigned int) pwm[t].period.count) {
+        cmp = pwm[t].period.count;
+    }
+
+    switch (t) {
+        case TIMER0:
+            rTCMPB0 = cmp;
+            break;
+        case TIMER1:
+            rTCMPB1 = cmp;
+            break;
+        case TIMER2:
+            rTCMPB2 = cmp;
+            break;
+        case TIMER3:
+            rTCMPB3 = cmp;
+            break;
+        case TIMER4:
+            rTCMPB4 = cmp;
+            break;
+        default:
+            return -1;
+    }
+
+    return 0;
+}
+
+// Drive TOUT1 as the complement of TOUT0, with a dead zone of
+// (at least) `ns` nanoseconds between the edges of both outputs.
+// 0 turns the dead zone off, and TOUT1 back to timer 1.
+// Timer 0 must have been set up with pwm_init first, the dead zone
+// is counted in timer 0 ticks. Timer 1 can't be used as a PWM
+// output meanwhile.
+// Returns -1 if `ns` is over 255 timer 0 ticks
+int pwm_set_deadzone(unsigned int ns) {
+    struct tmr_txn tx;
+    unsigned int scale = TMR_SCALE(pwm[0].period.prescaler, pwm[0].period.div);
+    unsigned long long len;
+
+    if (pwm[0].scale == 0) {
+        return -1;
+    }
+
+    // Round up, the dead zone is a minimum
+    len = ((unsigned long long) ns * MCLK + scale * 1000000000ULL - 1)
+          / (scale * 1000000000ULL);
+    if (len > 0xFF) {
+        return -1;
+    }
+
+    tmr_txn_begin(&tx);
+    tmr_txn_deadzone(&tx, (ns > 0) ? ENABLE : DISABLE, len);
+    tmr_txn_commit(&tx);
+
+    // nTOUT0 comes out of TOUT1 (PE4)
+    if (ns > 0) {
+        rPCONE = (rPCONE & ~(0x3 << 8)) | (0x2 << 8);
+    }
+
+    return 0;
+}
+
+// Start outputting on the TOUTn pin
+int pwm_start(enum tmr_timer t) {
+    if (t < TIMER0 || t > TIMER4) {
+        return -1;
+    }
+
+    return tmr_start(t);
+}
+
+// Stop the timer, the pin keeps its current level
+int pwm_stop(enum tmr_timer t) {
+    if (t < TIMER0 || t > TIMER4) {
+        return -1;
+    }
+
+    return tmr_stop(t);
+}
@@ -0,0 +1,16 @@
+// PWM outputs on TOUT0-4 (port E pins 3-7)
+
+#ifndef PWM_H_
+#define PWM_H_
+
+#include "44b.h"
+#include "timer.h"
+
+int pwm_init(enum tmr_timer t, unsigned int period_ns, enum enable invert,
+             struct tperiod *res);
+int pwm_set_duty(enum tmr_timer t, unsigned int permille);
+int pwm_set_deadzone(unsigned int ns);
+int pwm_start(enum tmr_timer t);
+int pwm_stop(enum tmr_timer t);
+
+#endif
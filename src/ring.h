@@ -1,20 +1,45 @@
 #ifndef _RING_H_
 #define _RING_H_
 
+// Ring capacities must be a power of two, so indices can be masked
+// instead of wrapped with a division
+#define RING_POW2(n) ((n) != 0 && ((n) & ((n) - 1)) == 0)
+
+// Keep the compiler from moving memory accesses across this point
+// The ARM7 core executes in order, so this is all the ordering
+// a single producer / single consumer pair needs
+// (tests/ring_spsc.c overrides it to switch between both sides)
+#ifndef RING_BARRIER
+#define RING_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+// Single producer / single consumer (SPSC)
+// The ring can be shared between an ISR and the main loop without
+// disabling interrupts, as long as one side only calls producer
+// functions and the other only consumer ones:
+//   producer: ring_push, ring_reserve, ring_commit
+//   consumer: ring_get, ring_get_n, ring_peek, ring_consume
+// The producer only writes `start`, the consumer only writes `end`,
+// and the elements are published/released after a RING_BARRIER.
+// ring_put and ring_put_n are NOT SPSC safe: when the ring is full
+// they move `end` to drop old values. ring_reset touches both.
+
 struct ring_t {
     // Backing array
     char* buffer;
-    // Start and end pointers
-    unsigned int start;
-    unsigned int end;
-    // Max capacity of the buffer
+    // Free-running write (start) and read (end) counters,
+    // masked on access. start - end is the number of elements.
+    volatile unsigned int start;
+    volatile unsigned int end;
+    // Max capacity of the buffer (power of two)
     unsigned int capacity;
-    // 1 -> full
-    unsigned int full;
+    // capacity - 1
+    unsigned int mask;
 };
 
 // Initialize a ring buffer (byo ring and buffer)
-void ring_init(struct ring_t* ring, char* buffer, unsigned int size);
+// Returns -1 if size is not a power of two
+int ring_init(struct ring_t* ring, char* buffer, unsigned int size);
 
 // Mark ring as empty
 void ring_reset(struct ring_t* ring);
@@ -23,9 +48,38 @@ void ring_reset(struct ring_t* ring);
 // Old values will be overwritten
 void ring_put(struct ring_t* ring, char data);
 
+// Push a value to the ring, if there's room (SPSC producer)
+// Returns -1 if the ring is full
+int ring_push(struct ring_t* ring, char data);
+
 // Pop head of the ring
 int ring_get(struct ring_t* ring, char* data);
 
+// Push n values to the ring
+// Old values will be overwritten, if n > capacity
+// only the last capacity values are kept
+void ring_put_n(struct ring_t* ring, const char* data, unsigned int n);
+
+// Pop up to n values from the ring, return how many were read
+unsigned int ring_get_n(struct ring_t* ring, char* data, unsigned int n);
+
+// Get a contiguous writable region of up to `want` elements at the
+// head of the ring, in `ptr`. Returns its length, which can be
+// shorter than `want` if the ring is nearly full or the region
+// would wrap around. Never overwrites unread values.
+unsigned int ring_reserve(struct ring_t* ring, char** ptr, unsigned int want);
+
+// Publish `n` elements written to the last reserved region
+void ring_commit(struct ring_t* ring, unsigned int n);
+
+// Get the contiguous readable region at the tail of the ring,
+// in `ptr`. Returns its length (0 if the ring is empty).
+unsigned int ring_peek(struct ring_t* ring, char** ptr);
+
+// Drop the first `n` elements of the ring, once they have been read
+// through ring_peek. Returns how many were dropped.
+unsigned int ring_consume(struct ring_t* ring, unsigned int n);
+
 // 1 -> empty, 0 -> not
 int ring_empty(struct ring_t* ring);
 
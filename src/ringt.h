@@ -0,0 +1,197 @@
+// Typed ring buffers
+//
+// RING_DECLARE(name, type) generates `struct name` and a set of
+// `name_*` functions with the same API and semantics as ring_t
+// (see ring.h), storing elements of `type` instead of char.
+// ring_t itself is RING_FUNCS(ring, struct ring_t, char, ) in ring.c.
+// Elements are copied whole, so word-sized or word-aligned struct
+// elements are moved with word loads/stores (LDM/STM for structs).
+//
+// Example, a ring of key events posted from an ISR:
+//
+//   struct key_ev { unsigned short key; unsigned short state; unsigned int when; };
+//   RING_DECLARE(kev_ring, struct key_ev)
+//
+//   static struct key_ev kev_buf[8];
+//   static struct kev_ring kevs;
+//   kev_ring_init(&kevs, kev_buf, 8);
+//   kev_ring_push(&kevs, ev);
+
+#ifndef RINGT_H_
+#define RINGT_H_
+
+#include <string.h>
+#include "ring.h"
+
+// Functions of a ring of `type` named `name`, on `sname` (a struct
+// with the same fields as ring_t), with `linkage` (static inline, or
+// nothing for the ring_t functions in ring.c)
+#define RING_FUNCS(name, sname, type, linkage)                                \
+                                                                              \
+linkage void name##_reset(sname* ring) {                                      \
+    ring->start = 0;                                                          \
+    ring->end = 0;                                                            \
+}                                                                             \
+                                                                              \
+linkage int name##_init(sname* ring, type* buffer, unsigned int size) {       \
+    if (!RING_POW2(size)) {                                                   \
+        return -1;                                                            \
+    }                                                                         \
+    ring->buffer = buffer;                                                    \
+    ring->capacity = size;                                                    \
+    ring->mask = size - 1;                                                    \
+    name##_reset(ring);                                                       \
+    return 0;                                                                 \
+}                                                                             \
+                                                                              \
+linkage unsigned int name##_size(sname* ring) {                               \
+    return (ring->start - ring->end);                                         \
+}                                                                             \
+                                                                              \
+linkage unsigned int name##_capacity(sname* ring) {                           \
+    return ring->capacity;                                                    \
+}                                                                             \
+                                                                              \
+linkage int name##_empty(sname* ring) {                                       \
+    return (ring->start == ring->end);                                        \
+}                                                                             \
+                                                                              \
+linkage int name##_full(sname* ring) {                                        \
+    return (ring->start - ring->end == ring->capacity);                       \
+}                                                                             \
+                                                                              \
+/* Old values will be overwritten, not SPSC safe */                           \
+linkage void name##_put(sname* ring, type data) {                             \
+    ring->buffer[ring->start & ring->mask] = data;                            \
+    ring->start++;                                                            \
+    if (ring->start - ring->end > ring->capacity) {                           \
+        ring->end++;                                                          \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+/* SPSC producer, -1 if full */                                               \
+linkage int name##_push(sname* ring, type data) {                             \
+    unsigned int start = ring->start;                                         \
+    if (start - ring->end == ring->capacity) {                                \
+        return -1;                                                            \
+    }                                                                         \
+    RING_BARRIER();                                                           \
+    ring->buffer[start & ring->mask] = data;                                  \
+    RING_BARRIER();                                                           \
+    ring->start = start + 1;                                                  \
+    return 0;                                                                 \
+}                                                                             \
+                                                                              \
+/* SPSC consumer, -1 if empty */                                              \
+linkage int name##_get(sname* ring, type* data) {                             \
+    unsigned int end = ring->end;                                             \
+    if (ring->start == end) {                                                 \
+        return -1;                                                            \
+    }                                                                         \
+    RING_BARRIER();                                                           \
+    *data = ring->buffer[end & ring->mask];                                   \
+    RING_BARRIER();                                                           \
+    ring->end = end + 1;                                                      \
+    return 0;                                                                 \
+}                                                                             \
+                                                                              \
+/* Old values will be overwritten, not SPSC safe */                           \
+linkage void name##_put_n(sname* ring, const type* data,                      \
+                          unsigned int n) {                                   \
+    unsigned int off;                                                         \
+    unsigned int first;                                                       \
+    if (n > ring->capacity) {                                                 \
+        data += n - ring->capacity;                                           \
+        n = ring->capacity;                                                   \
+    }                                                                         \
+    off = ring->start & ring->mask;                                           \
+    first = ring->capacity - off;                                             \
+    if (first > n) {                                                          \
+        first = n;                                                            \
+    }                                                                         \
+    memcpy(&ring->buffer[off], data, first * sizeof(type));                   \
+    memcpy(ring->buffer, data + first, (n - first) * sizeof(type));           \
+    ring->start += n;                                                         \
+    if (ring->start - ring->end > ring->capacity) {                           \
+        ring->end = ring->start - ring->capacity;                             \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+/* SPSC consumer */                                                           \
+linkage unsigned int name##_get_n(sname* ring, type* data,                    \
+                                  unsigned int n) {                           \
+    unsigned int off;                                                         \
+    unsigned int first;                                                       \
+    unsigned int size = name##_size(ring);                                    \
+    if (n > size) {                                                           \
+        n = size;                                                             \
+    }                                                                         \
+    RING_BARRIER();                                                           \
+    off = ring->end & ring->mask;                                             \
+    first = ring->capacity - off;                                             \
+    if (first > n) {                                                          \
+        first = n;                                                            \
+    }                                                                         \
+    memcpy(data, &ring->buffer[off], first * sizeof(type));                   \
+    memcpy(data + first, ring->buffer, (n - first) * sizeof(type));           \
+    RING_BARRIER();                                                           \
+    ring->end += n;                                                           \
+    return n;                                                                 \
+}                                                                             \
+                                                                              \
+/* SPSC producer */                                                           \
+linkage unsigned int name##_reserve(sname* ring, type** ptr,                  \
+                                    unsigned int want) {                      \
+    unsigned int off = ring->start & ring->mask;                              \
+    unsigned int room = ring->capacity - name##_size(ring);                   \
+    if (room > ring->capacity - off) {                                        \
+        room = ring->capacity - off;                                          \
+    }                                                                         \
+    if (want > room) {                                                        \
+        want = room;                                                          \
+    }                                                                         \
+    RING_BARRIER();                                                           \
+    *ptr = &ring->buffer[off];                                                \
+    return want;                                                              \
+}                                                                             \
+                                                                              \
+linkage void name##_commit(sname* ring, unsigned int n) {                     \
+    RING_BARRIER();                                                           \
+    ring->start += n;                                                         \
+}                                                                             \
+                                                                              \
+/* SPSC consumer */                                                           \
+linkage unsigned int name##_peek(sname* ring, type** ptr) {                   \
+    unsigned int off = ring->end & ring->mask;                                \
+    unsigned int size = name##_size(ring);                                    \
+    if (size > ring->capacity - off) {                                        \
+        size = ring->capacity - off;                                          \
+    }                                                                         \
+    RING_BARRIER();                                                           \
+    *ptr = &ring->buffer[off];                                                \
+    return size;                                                              \
+}                                                                             \
+                                                                              \
+linkage unsigned int name##_consume(sname* ring, unsigned int n) {            \
+    unsigned int size = name##_size(ring);                                    \
+    if (n > size) {                                                           \
+        n = size;                                                             \
+    }                                                                         \
+    RING_BARRIER();                                                           \
+    ring->end += n;                                                           \
+    return n;                                                                 \
+}
+
+#define RING_DECLARE(name, type)                                              \
+                                                                              \
+struct name {                                                                 \
+    type* buffer;                                                             \
+    volatile unsigned int start;                                              \
+    volatile unsigned int end;                                                \
+    unsigned int capacity;                                                    \
+    unsigned int mask;                                                        \
+};                                                                            \
+                                                                              \
+RING_FUNCS(name, struct name, type, static inline)
+
+#endif
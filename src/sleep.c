@@ -0,0 +1,106 @@
+#include "44b.h"
+#include "intcontroller.h"
+#include "timer.h"
+#include "sleep.h"
+
+// TIMER4 runs at MCLK / (0 + 1) / 16 = 4 MHz
+// The prescaler is shared with TIMER5 (the clock), which also uses 0
+#define SLEEP_PRESCALER 0
+#define SLEEP_TICKS_US ((MCLK) / (SLEEP_PRESCALER + 1) / 16 / 1000000)
+
+// Longest single TIMER4 run (0x10000 ticks), in microseconds
+#define SLEEP_CHUNK_US (0x10000 / SLEEP_TICKS_US)
+
+// Set by the TIMER4 ISR when the current run is over
+static volatile int woken;
+
+void Sleep_TimerInt(void) __attribute__ ((interrupt ("IRQ")));
+
+// TIMER4 ISR, the one-shot reached 0
+void Sleep_TimerInt(void) {
+    woken = 1;
+    ic_cleanflag(INT_TIMER4);
+}
+
+// Set up TIMER4 as a one-shot at 4 MHz
+// Should be called after ic_init
+int sleep_init(void) {
+    struct tmr_txn tx;
+
+    tmr_txn_begin(&tx);
+    if (tmr_txn_prescaler(&tx, 2, SLEEP_PRESCALER) != 0 ||
+        tmr_txn_divider(&tx, 4, D1_16) != 0 ||
+        tmr_txn_mode(&tx, TIMER4, ONE_SHOT) != 0 ||
+        tmr_txn_stop(&tx, TIMER4) != 0) {
+        return -1;
+    }
+    tmr_txn_commit(&tx);
+
+    pISR_TIMER4 = (int) Sleep_TimerInt;
+    ic_conf_line(INT_TIMER4, IRQ);
+    ic_enable(INT_TIMER4);
+
+    return 0;
+}
+
+// Stop the CPU clock until the next interrupt
+// Setting rCLKCON[2] enters IDLE mode, and any interrupt request wakes
+// the core up. The ISR runs, and then we resume right after the write.
+// The bit is not cleared by the wake-up, clear it here so the next
+// write to CLKCON doesn't idle the core again.
+void sleep_idle(void) {
+    rCLKCON |= (0x1 << 2);
+    rCLKCON &= ~(0x1 << 2);
+}
+
+// Run TIMER4 for `ticks` ticks (1 to 0x10000), idling until it's done
+static void sleep_ticks(unsigned int ticks) {
+    struct tmr_txn tx;
+
+    woken = 0;
+    tmr_txn_begin(&tx);
+    // The timer runs count + 1 ticks
+    tmr_txn_count(&tx, TIMER4, ticks - 1, 0);
+    tmr_txn_start(&tx, TIMER4);
+    tmr_txn_commit(&tx);
+
+    // Other interrupts wake us up too, go back to sleep.
+    // If TIMER4 fires right between the check and sleep_idle,
+    // the next interrupt (at worst the 1ms wheel tick) wakes us up.
+    while (woken == 0) {
+        sleep_idle();
+    }
+
+    tmr_stop(TIMER4);
+}
+
+// Sleep for at least `us` microseconds, with the CPU idle
+// Interrupts keep being served meanwhile.
+// Must not be called from an ISR, TIMER4 couldn't wake us up;
+// use Delay there.
+int sleep_us(unsigned int us) {
+    unsigned int chunk;
+
+    if (us == 0) {
+        return 0;
+    }
+
+    // One-shot runs of at most SLEEP_CHUNK_US (~16ms)
+    while (us > 0) {
+        chunk = (us > SLEEP_CHUNK_US) ? SLEEP_CHUNK_US : us;
+        sleep_ticks(chunk * SLEEP_TICKS_US);
+        us -= chunk;
+    }
+
+    return 0;
+}
+
+// Sleep for at least `ms` milliseconds, see sleep_us
+int sleep_ms(unsigned int ms) {
+    while (ms > 1000) {
+        sleep_us(1000 * 1000);
+        ms -= 1000;
+    }
+
+    return sleep_us(ms * 1000);
+}
@@ -0,0 +1,11 @@
+// Timer-backed sleeps, on TIMER4
+
+#ifndef SLEEP_H_
+#define SLEEP_H_
+
+int sleep_init(void);
+void sleep_idle(void);
+int sleep_us(unsigned int us);
+int sleep_ms(unsigned int ms);
+
+#endif
@@ -1,7 +1,53 @@
 
+#include <stddef.h>
 #include "44b.h"
 #include "timer.h"
 
+// Timers whose divider has been set, one bit per timer. A configured
+// timer owns its prescaler, even while it's stopped (display, sleep),
+// so tmr_solve_period won't pick a new value for its sibling.
+static unsigned int tmr_configured;
+
+// rTCON is a 27-bit wide register divided in 5 timer zones + dead zone,
+// with the latter interleaved between the zones of timer 0 and 1.
+// Return the offset of the zone of timer `t`, or -1 if invalid
+static int tmr_tcon_offset(enum tmr_timer t) {
+    if (t < 0 || t > 5) {
+        return -1;
+    }
+
+    // Skip dead zone located between timer 0 and 1 (4 bits)
+    return (t > 0) ? t * 4 + 4 : 0;
+}
+
+// rTCON auto reload bit of timer `t`, within its zone
+// Timer 5 has no inverter, so its zone is only 3 bits wide
+// and auto reload is bit 2 (rTCON[26]) instead of bit 3
+static unsigned int tmr_reload_bit(enum tmr_timer t) {
+    return (t == TIMER5) ? 0x4 : 0x8;
+}
+
+// rTCFG1 value for divider `div_v` on timer `d`, or -1 if the timer
+// doesn't support it
+static int tmr_div_value(int d, enum tmr_div div_v) {
+    int invalid_timer = (d < 0 || d > 5);
+    int invalid_divisor = (div_v < D1_2 || div_v > TCLK) ||
+                          (div_v == D1_32 && d > 3) ||
+                          (div_v == EXTCLK && d != 5) ||
+                          (div_v == TCLK && d != 4);
+
+    if (invalid_timer || invalid_divisor) {
+        return -1;
+    }
+
+    // Map those values to the correct int cast
+    if (div_v == EXTCLK || div_v == TCLK) {
+        return 4;
+    }
+
+    return div_v;
+}
+
 // Set the prescaler `p` to the given `value`
 // Each `p` is shared among two timers
 // p = 0 for timer 0 and 1
@@ -33,21 +79,12 @@ int tmr_set_prescaler(int p, int value) {
 // Set the divider `d` to the given value `div_v`
 int tmr_set_divider(int d, enum tmr_div div_v) {
     int offset = d * 4;
+    int value = tmr_div_value(d, div_v);
 
-    int invalid_timer = (d < 0 || d > 5);
-    int invalid_divisor = (div_v == D1_32 && d > 3) ||
-                          (div_v == EXTCLK && d != 5) ||
-                          (div_v == TCLK && d != 4);
-
-    if (invalid_timer || invalid_divisor) {
+    if (value < 0) {
         return -1;
     }
 
-    // Map those values to the correct int cast
-    if (div_v == EXTCLK || div_v == TCLK) {
-        div_v = 4;
-    }
-
     // rTCFG1 is a 28-bit wide reg, dividied in 6 4-bit MUX zones
     // (one for each timer), and a 4-bit DMA mode zone.
     // Depending on the MUX, certain values will be valid
@@ -69,9 +106,11 @@ int tmr_set_divider(int d, enum tmr_div div_v) {
 
     // Have to write `div_v` at `offset` bits in rTCFG1
     rTCFG1 = ( (rTCFG1 & ~(0xF << offset)) // Zero-out the target bits
-             | (div_v << offset) // Then flip to 1 those in `value`
+             | (value << offset) // Then flip to 1 those in `value`
              );
 
+    tmr_configured |= 0x1 << d;
+
     return 0;
 }
 
@@ -110,22 +149,36 @@ int tmr_set_count(enum tmr_timer t, int count, int cmp) {
     return 0;
 }
 
+// Read the current value of the timer `t` counter (rTCNTOn)
+// Returns -1 on an invalid timer
+int tmr_get_count(enum tmr_timer t) {
+    switch (t) {
+        case TIMER0:
+            return rTCNTO0 & 0xFFFF;
+        case TIMER1:
+            return rTCNTO1 & 0xFFFF;
+        case TIMER2:
+            return rTCNTO2 & 0xFFFF;
+        case TIMER3:
+            return rTCNTO3 & 0xFFFF;
+        case TIMER4:
+            return rTCNTO4 & 0xFFFF;
+        case TIMER5:
+            return rTCNTO5 & 0xFFFF;
+        default:
+            return -1;
+    }
+}
+
 // Force-update the timer `t`
 int tmr_update(enum tmr_timer t) {
-    int offset = t * 4;
+    int offset = tmr_tcon_offset(t);
 
-    if (t < 0 || t > 5) {
+    if (offset < 0) {
         return -1;
     }
 
-    // Skip dead zone located between timer 0 and 1 (4 bits)
-    if (t > 0) {
-        offset += 4;
-    }
-
-    // rTCON is a 27-bit wide register divided in 5 timer zones + dead zone,
-    // with the latter interleaved between the zones of timer 0 and 1.
-    // In each timer zone, we get the bits
+    // In each timer zone of rTCON, we get the bits
     // 0 -> start(1) / stop(0)
     // 1 -> manual update. (0) => noop (1) => do update
     // 2 -> inverter on(1) / off (0)
@@ -141,30 +194,25 @@ int tmr_update(enum tmr_timer t) {
 
 // Configure mode for timer `t`
 int tmr_set_mode(enum tmr_timer t, enum tmr_mode mode) {
-    int offset = t * 4;
+    int offset = tmr_tcon_offset(t);
 
-    if (t < 0 || t > 5) {
+    if (offset < 0) {
         return -1;
     }
 
-    // Skip dead zone located between timer 0 and 1 (4 bits)
-    if (t > 0) {
-        offset += 4;
-    }
-
     // In each timer zone, we get the bits
     // 0 -> start(1) / stop(0)
     // 1 -> manual update. (0) => noop (1) => do update
     // 2 -> inverter on(1) / off (0)
     // 3 -> auto reload (1) / one shot (0)
+    // Timer 5 has no inverter, auto reload is its bit 2
 
     switch (mode) {
         case ONE_SHOT:
-            // one-shot is located at the 4th bit
-            rTCON &= ~(0b1000 << offset);
+            rTCON &= ~(tmr_reload_bit(t) << offset);
             break;
         case RELOAD:
-            rTCON |= (0b1000 << offset);
+            rTCON |= (tmr_reload_bit(t) << offset);
             break;
         default:
            return -1;
@@ -174,17 +222,12 @@ int tmr_set_mode(enum tmr_timer t, enum tmr_mode mode) {
 }
 
 int tmr_start(enum tmr_timer t) {
-    int offset = t * 4;
+    int offset = tmr_tcon_offset(t);
 
-    if (t < 0 || t > 5) {
+    if (offset < 0) {
         return -1;
     }
 
-    // Skip dead zone
-    if (t > 0) {
-        offset += 4;
-    }
-
     // rTCON[0 + offset] -> start(1) / stop(0)
     rTCON |= (0x1 << offset);
 
@@ -192,17 +235,12 @@ int tmr_start(enum tmr_timer t) {
 }
 
 int tmr_stop(enum tmr_timer t) {
-    int offset = t * 4;
+    int offset = tmr_tcon_offset(t);
 
-    if (t < 0 || t > 5) {
+    if (offset < 0) {
         return -1;
     }
 
-    // Skip dead zone
-    if (t > 0) {
-        offset += 4;
-    }
-
     // rTCON[0 + offset] -> start(1) / stop(0)
     rTCON &= ~(0x1 << offset);
 
@@ -215,17 +253,12 @@ int tmr_stop(enum tmr_timer t) {
 // 0 is not running
 // 1 is running
 int tmr_isrunning(enum tmr_timer t) {
-    int offset = t * 4;
+    int offset = tmr_tcon_offset(t);
 
-    if (t < 0 || t > 5) {
+    if (offset < 0) {
         return -1;
     }
 
-    // Skip dead zone
-    if (t > 0) {
-        offset += 4;
-    }
-
     // Is the start bit set to 1?
     if ((rTCON & (0x1 << offset))) {
         return 1;
@@ -233,3 +266,298 @@ int tmr_isrunning(enum tmr_timer t) {
 
     return 0;
 }
+
+// Start a new, empty, transaction
+void tmr_txn_begin(struct tmr_txn *tx) {
+    tx->cfg0_mask = 0;
+    tx->cfg0 = 0;
+    tx->cfg1_mask = 0;
+    tx->cfg1 = 0;
+    tx->con_mask = 0;
+    tx->con = 0;
+    tx->update = 0;
+    tx->starts = 0;
+    tx->counts = 0;
+}
+
+// Stage prescaler `p` to `value`, see tmr_set_prescaler
+int tmr_txn_prescaler(struct tmr_txn *tx, int p, int value) {
+    int offset = p * 8;
+
+    if (p < 0 || p > 3) {
+        return -1;
+    }
+
+    tx->cfg0_mask |= 0xFF << offset;
+    tx->cfg0 = (tx->cfg0 & ~(0xFF << offset)) | ((value & 0xFF) << offset);
+    return 0;
+}
+
+// Stage divider `d` to `div_v`, see tmr_set_divider
+int tmr_txn_divider(struct tmr_txn *tx, int d, enum tmr_div div_v) {
+    int offset = d * 4;
+    int value = tmr_div_value(d, div_v);
+
+    if (value < 0) {
+        return -1;
+    }
+
+    tx->cfg1_mask |= 0xF << offset;
+    tx->cfg1 = (tx->cfg1 & ~(0xF << offset)) | (value << offset);
+    return 0;
+}
+
+// Stage the count and cmp buffers of timer `t`. They are loaded
+// into the timer (manual update) on commit.
+int tmr_txn_count(struct tmr_txn *tx, enum tmr_timer t, int count, int cmp) {
+    int offset = tmr_tcon_offset(t);
+
+    if (offset < 0) {
+        return -1;
+    }
+
+    tx->count[t] = count;
+    tx->cmp[t] = cmp;
+    tx->counts |= 0x1 << t;
+    tx->update |= 0x2 << offset;
+    return 0;
+}
+
+// Stage the mode of timer `t`, see tmr_set_mode
+int tmr_txn_mode(struct tmr_txn *tx, enum tmr_timer t, enum tmr_mode mode) {
+    int offset = tmr_tcon_offset(t);
+
+    if (offset < 0 || (mode != ONE_SHOT && mode != RELOAD)) {
+        return -1;
+    }
+
+    tx->con_mask |= tmr_reload_bit(t) << offset;
+    if (mode == RELOAD) {
+        tx->con |= tmr_reload_bit(t) << offset;
+    } else {
+        tx->con &= ~(tmr_reload_bit(t) << offset);
+    }
+    return 0;
+}
+
+// Stage the output inverter of timer `t` (rTCON bit 2 of its zone)
+int tmr_txn_inverter(struct tmr_txn *tx, enum tmr_timer t, enum enable st) {
+    int offset = tmr_tcon_offset(t);
+
+    // Timer 5 has no output, nor inverter (its bit 2 is auto reload)
+    if (offset < 0 || t == TIMER5) {
+        return -1;
+    }
+
+    tx->con_mask |= 0x4 << offset;
+    if (st == ENABLE) {
+        tx->con |= 0x4 << offset;
+    } else {
+        tx->con &= ~(0x4 << offset);
+    }
+    return 0;
+}
+
+// Stage the dead zone of timers 0/1. When enabled, TOUT1 outputs
+// the inverse of TOUT0, and both edges of TOUT0 are delayed by
+// `len` timer 0 ticks (rTCFG0[31:24]) so the outputs never overlap.
+int tmr_txn_deadzone(struct tmr_txn *tx, enum enable st, int len) {
+    if (len < 0 || len > 0xFF) {
+        return -1;
+    }
+
+    // rTCON[4] enables the dead zone
+    tx->con_mask |= 0x10;
+    if (st == ENABLE) {
+        tx->con |= 0x10;
+        tx->cfg0_mask |= 0xFF << 24;
+        tx->cfg0 = (tx->cfg0 & ~(0xFF << 24)) | (len << 24);
+    } else {
+        tx->con &= ~0x10;
+    }
+    return 0;
+}
+
+// Stage a configuration found by tmr_solve_period on timer `t`
+int tmr_txn_period(struct tmr_txn *tx, enum tmr_timer t, struct tperiod *period) {
+    if (tmr_txn_prescaler(tx, t / 2, period->prescaler) != 0 ||
+        tmr_txn_divider(tx, t, period->div) != 0 ||
+        tmr_txn_count(tx, t, period->count, 0) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Stage starting timer `t`
+// All the timers started on the same transaction start together
+int tmr_txn_start(struct tmr_txn *tx, enum tmr_timer t) {
+    int offset = tmr_tcon_offset(t);
+
+    if (offset < 0) {
+        return -1;
+    }
+
+    tx->con_mask |= 0x1 << offset;
+    tx->con |= 0x1 << offset;
+    tx->starts |= 0x1 << offset;
+    return 0;
+}
+
+// Stage stopping timer `t`
+int tmr_txn_stop(struct tmr_txn *tx, enum tmr_timer t) {
+    int offset = tmr_tcon_offset(t);
+
+    if (offset < 0) {
+        return -1;
+    }
+
+    tx->con_mask |= 0x1 << offset;
+    tx->con &= ~(0x1 << offset);
+    tx->starts &= ~(0x1 << offset);
+    return 0;
+}
+
+// Apply every staged setting, with one write per register
+// Timers with a new count need a second rTCON write: the manual
+// update bit has to be cleared on the next write, and the timers
+// are started on that one.
+void tmr_txn_commit(struct tmr_txn *tx) {
+    int t;
+    unsigned int con;
+
+    if (tx->cfg0_mask != 0) {
+        rTCFG0 = (rTCFG0 & ~tx->cfg0_mask) | tx->cfg0;
+    }
+
+    if (tx->cfg1_mask != 0) {
+        rTCFG1 = (rTCFG1 & ~tx->cfg1_mask) | tx->cfg1;
+    }
+
+    for (t = TIMER0; t <= TIMER5; t++) {
+        if (tx->cfg1_mask & (0xF << (t * 4))) {
+            tmr_configured |= 0x1 << t;
+        }
+
+        if (tx->counts & (0x1 << t)) {
+            tmr_set_count(t, tx->count[t], tx->cmp[t]);
+        }
+    }
+
+    con = (rTCON & ~(tx->con_mask | tx->update)) | tx->con;
+
+    // Load the new counts, without starting the timers yet
+    if (tx->update != 0) {
+        rTCON = (con & ~tx->starts) | tx->update;
+    }
+
+    rTCON = con;
+}
+
+// Find the prescaler, divider and count giving the period closest
+// to `ns` nanoseconds on timer `t`, and the period (and error) we
+// would really get with them.
+// If the sibling timer sharing the prescaler is configured (see
+// tmr_configured) or running, its prescaler value is kept, and only
+// the divider and count are searched.
+// Returns -1 if the period can't be obtained within TMR_PERIOD_TOL
+int tmr_solve_period(enum tmr_timer t, unsigned int ns, struct tperiod *res) {
+    int p;
+    int pmin = 0;
+    int pmax = 255;
+    int div;
+    int maxdiv;
+    unsigned int scale;
+    unsigned long long cycles;
+    unsigned long long ticks;
+    unsigned long long actual;
+    long long error;
+    long long best = -1;
+
+    if (t < 0 || t > 5 || ns == 0) {
+        return -1;
+    }
+
+    // Don't touch the prescaler of a sibling in use (0-1, 2-3, 4-5)
+    if ((tmr_configured & (0x1 << (t ^ 1))) || tmr_isrunning(t ^ 1) == 1) {
+        pmin = (rTCFG0 >> ((t / 2) * 8)) & 0xFF;
+        pmax = pmin;
+    }
+
+    // Timers 4 and 5 have no 1/32 divider
+    maxdiv = (t > 3) ? D1_16 : D1_32;
+
+    // Requested period in MCLK cycles, scaled by 1e9 to keep
+    // the rounding exact
+    cycles = (unsigned long long) ns * MCLK;
+
+    for (div = D1_2; div <= maxdiv; div++) {
+        for (p = pmin; p <= pmax; p++) {
+            scale = TMR_SCALE(p, div);
+
+            // Ticks per period, the count is one less (see timer.h)
+            ticks = (cycles + scale * 500000000ULL) / (scale * 1000000000ULL);
+            if (ticks == 0) {
+                ticks = 1;
+            } else if (ticks > 0x10000) {
+                // Larger prescalers give less ticks, keep going
+                continue;
+            }
+
+            actual = (ticks * scale * 1000000000ULL) / MCLK;
+            error = (long long) actual - ns;
+            if (error < 0) {
+                error = -error;
+            }
+
+            // Keep the first (finest) hit on ties
+            if (best < 0 || error < best) {
+                best = error;
+                res->prescaler = p;
+                res->div = div;
+                res->count = ticks - 1;
+                res->actual = actual;
+                res->error = (int) ((long long) actual - ns);
+            }
+
+            // The ticks only get coarser from here on
+            if (error == 0) {
+                break;
+            }
+        }
+    }
+
+    if (best < 0 || best * 10000 > (long long) ns * TMR_PERIOD_TOL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Configure timer `t` to fire every `ns` nanoseconds (or once
+// after them, in ONE_SHOT mode). The configuration used is
+// copied into `res`, if not NULL. The timer is left stopped.
+// Returns -1 if the period can't be obtained (see tmr_solve_period)
+int tmr_set_period(enum tmr_timer t, unsigned int ns, enum tmr_mode mode,
+                   struct tperiod *res) {
+    struct tperiod period;
+    struct tmr_txn tx;
+
+    if (tmr_solve_period(t, ns, &period) != 0) {
+        return -1;
+    }
+
+    if (res != NULL) {
+        *res = period;
+    }
+
+    tmr_txn_begin(&tx);
+    if (tmr_txn_stop(&tx, t) != 0 ||
+        tmr_txn_period(&tx, t, &period) != 0 ||
+        tmr_txn_mode(&tx, t, mode) != 0) {
+        return -1;
+    }
+
+    tmr_txn_commit(&tx);
+    return 0;
+}
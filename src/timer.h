@@ -3,6 +3,14 @@
 #ifndef TIMER_H_
 #define TIMER_H_
 
+#include "44b.h"
+
+// Max period error accepted by tmr_set_period,
+// in hundredths of a percent (100 -> 1.00%)
+#ifndef TMR_PERIOD_TOL
+#define TMR_PERIOD_TOL 100
+#endif
+
 enum tmr_timer {
     TIMER0 = 0,
     TIMER1 = 1,
@@ -27,13 +35,83 @@ enum tmr_mode {
     RELOAD = 1
 };
 
+// Result of a timer period search
+struct tperiod {
+    // Prescaler value (0-255), divider and count (rTCNTBn value,
+    // the period is count + 1 ticks)
+    int prescaler;
+    enum tmr_div div;
+    int count;
+    // Period actually obtained, in ns
+    unsigned int actual;
+    // Error of `actual` against the requested period, in ns (signed)
+    int error;
+};
+
+// Staged configuration of one or more timers
+// Settings are checked as they are staged, and tmr_txn_commit
+// writes each register once
+struct tmr_txn {
+    // Bits to change, and their new values, on each register
+    unsigned int cfg0_mask;
+    unsigned int cfg0;
+    unsigned int cfg1_mask;
+    unsigned int cfg1;
+    unsigned int con_mask;
+    unsigned int con;
+    // rTCON manual update bits of the timers with a new count
+    unsigned int update;
+    // rTCON start bits of the timers being started
+    unsigned int starts;
+    // Timers with a new count/cmp (bit per timer)
+    unsigned int counts;
+    int count[6];
+    int cmp[6];
+};
+
+// MCLK cycles per tick for prescaler value `p` and divider `div`
+// (D1_2 to D1_32 only)
+#define TMR_SCALE(p, div) (((p) + 1) * (2 << (div)))
+
+// Counts and periods:
+// A timer loaded with count N (rTCNTBn) counts down from N to 0,
+// and reloads on the next tick, so its period is N + 1 ticks
+// (1 to 0x10000). Every count in this API is a rTCNTBn value.
+
+// Compile-time versions of tmr_solve_period, for a fixed divider:
+// smallest prescaler value that fits `ns` in 0x10000 ticks
+// (finest resolution), and the count giving the closest period with it.
+// Folds to constants if `ns` and `div` are constants. The result is
+// only valid if TMR_PRESCALER(ns, div) <= 255.
+#define TMR_CYCLES(ns) ((unsigned long long) (ns) * (MCLK) / 1000000000ULL)
+#define TMR_PRESCALER(ns, div) \
+    ((TMR_CYCLES(ns) + 0x10000 * (2 << (div)) - 1) / (0x10000 * (2 << (div))) - 1)
+#define TMR_COUNT(ns, div) \
+    ((TMR_CYCLES(ns) + TMR_SCALE(TMR_PRESCALER(ns, div), div) / 2) \
+     / TMR_SCALE(TMR_PRESCALER(ns, div), div) - 1)
+
 int tmr_set_prescaler(int p, int  value);
 int tmr_set_divider(int d, enum tmr_div div);
 int tmr_set_count(enum tmr_timer t, int count, int cmp);
 int tmr_set_mode(enum tmr_timer t, enum tmr_mode mode);
+int tmr_get_count(enum tmr_timer t);
 int tmr_update(enum tmr_timer t);
 int tmr_start(enum tmr_timer t);
 int tmr_stop(enum tmr_timer t);
 int tmr_isrunning(enum tmr_timer t);
+void tmr_txn_begin(struct tmr_txn *tx);
+int tmr_txn_prescaler(struct tmr_txn *tx, int p, int value);
+int tmr_txn_divider(struct tmr_txn *tx, int d, enum tmr_div div);
+int tmr_txn_count(struct tmr_txn *tx, enum tmr_timer t, int count, int cmp);
+int tmr_txn_mode(struct tmr_txn *tx, enum tmr_timer t, enum tmr_mode mode);
+int tmr_txn_inverter(struct tmr_txn *tx, enum tmr_timer t, enum enable st);
+int tmr_txn_deadzone(struct tmr_txn *tx, enum enable st, int len);
+int tmr_txn_period(struct tmr_txn *tx, enum tmr_timer t, struct tperiod *period);
+int tmr_txn_start(struct tmr_txn *tx, enum tmr_timer t);
+int tmr_txn_stop(struct tmr_txn *tx, enum tmr_timer t);
+void tmr_txn_commit(struct tmr_txn *tx);
+int tmr_solve_period(enum tmr_timer t, unsigned int ns, struct tperiod *res);
+int tmr_set_period(enum tmr_timer t, unsigned int ns, enum tmr_mode mode,
+                   struct tperiod *res);
 
 #endif
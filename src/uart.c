@@ -1,11 +1,70 @@
 #include <stdarg.h>
-#include <stdlib.h>
-#include <stdio.h>
 #include "44b.h"
 #include "uart.h"
 #include "intcontroller.h"
-
-#define BUFLEN 100
+#include "sleep.h"
+
+#ifdef UART_BENCH
+#include "clock.h"
+#endif
+
+// Size of the rx and tx rings, must be a power of two
+// (ring indices are masked instead of using %, which is a
+// libgcc division call on this CPU)
+#ifndef UART_BUFLEN
+#define UART_BUFLEN 128
+#endif
+
+#ifndef UART_OBUFLEN
+#define UART_OBUFLEN 256
+#endif
+
+// Size of the echo ring, must be a power of two
+#define EBUFLEN 16
+
+#define BUFMASK (UART_BUFLEN - 1)
+#define OBUFMASK (UART_OBUFLEN - 1)
+#define EBUFMASK (EBUFLEN - 1)
+
+// Fails to compile if the ring sizes are not powers of two
+typedef char uart_buflen_check[(UART_BUFLEN & BUFMASK) ? -1 : 1];
+typedef char uart_obuflen_check[(UART_OBUFLEN & OBUFMASK) ? -1 : 1];
+
+// Max length of a line edited by the Rx ISR on canonical mode
+// A full line plus its \n must fit in the rx ring
+#ifndef UART_LINE_MAX
+#define UART_LINE_MAX 64
+#endif
+
+typedef char uart_line_max_check[(UART_LINE_MAX < UART_BUFLEN) ? 1 : -1];
+
+// With auto flow control, stop draining the Rx FIFO once the rx ring
+// has less than FIFO_DEPTH bytes free, and resume once it's half empty
+#define AFC_HIGH (UART_BUFLEN - FIFO_DEPTH)
+#define AFC_LOW (UART_BUFLEN / 2)
+
+// uart_printf sends its output in chunks of this many bytes
+#define PRINTF_CHUNK 16
+
+// Depth of the Rx/Tx hardware FIFOs
+#define FIFO_DEPTH 16
+
+// On DMA rx mode, polls of an empty ring (with bytes stuck below
+// the Rx FIFO trigger level) before uart_getch/uart_getbuf read
+// them directly
+#define IDLE_SPINS 2000
+
+// Line being edited by the line discipline
+struct ldisc {
+    // Line contents, without the terminator
+    char *buf;
+    // Current length of the line
+    int len;
+    // Max length of the line, extra chars are dropped
+    int max;
+    // Last char fed, to merge \r\n into a single terminator
+    char last;
+};
 
 // Estructura utilizada para mantener el estado de cada puerto
 struct port_stat {
@@ -13,17 +72,75 @@ struct port_stat {
     enum URxTxMode rxmode;
     // Sending mode (DIS(abled) | POLL | INT | DMA)
     enum URxTxMode txmode;
-    // Inbound buffer (used only on INTerrupt mode)
-    // Treated as a ring buffer
-    unsigned char ibuf[BUFLEN];
-    // Read pointer into ibuf
-    volatile int rP;
-    // Write pointer into ibuf
-    volatile int wP;
-    // On INTerrupt mode, points to the string being sent
-    volatile char *sendP;
+    // Inbound buffer (used on INTerrupt and DMA mode)
+    // Treated as a single-producer (ISR), single-consumer ring buffer.
+    // Pointers are free-running counters, masked on access, so
+    // wP - rP is always the number of bytes in the ring
+    unsigned char ibuf[UART_BUFLEN];
+    // Read pointer into ibuf (only moved by the reader)
+    volatile unsigned int rP;
+    // Write pointer into ibuf (only moved by the Rx ISR)
+    // On DMA mode, it is read off the BDMA current destination
+    volatile unsigned int wP;
+    // Bytes dropped because ibuf was full
+    volatile unsigned int overflows;
+    // Max number of bytes ever waiting on ibuf
+    volatile unsigned int hwm;
+    // Line errors counted by the error ISR
+    volatile unsigned int overrun;
+    volatile unsigned int parity;
+    volatile unsigned int frame;
+    volatile unsigned int brk;
+    // Should bytes with parity/frame errors be discarded?
+    enum ONOFF errdrop;
+    // Bytes discarded by the error ISR
+    volatile unsigned int errdrops;
+    // Outbound buffer (used on INTerrupt and DMA mode)
+    // Treated as a ring buffer, drained by the Tx ISR, or by the BDMA
+    // channel one contiguous span at a time
+    unsigned char obuf[UART_OBUFLEN];
+    // Read pointer into obuf (moved by the Tx or BDMA ISR)
+    volatile unsigned int orP;
+    // Write pointer into obuf
+    volatile unsigned int owP;
+    // Echoed bytes, pushed by the Rx ISR and drained by the Tx ISR
+    // (ahead of obuf), or by their own BDMA transfers on DMA mode.
+    // Kept apart from obuf, so that each ring only has one producer.
+    unsigned char ebuf[EBUFLEN];
+    // Read pointer into ebuf (moved by the Tx ISR)
+    volatile unsigned int erP;
+    // Write pointer into ebuf (moved by the Rx ISR)
+    volatile unsigned int ewP;
+    // On DMA mode, set to 1 while a BDMA transfer is in flight
+    volatile int dmabusy;
+    // Bytes of obuf (or ebuf, if dmaecho is 1) in the BDMA
+    // transfer in flight
+    unsigned int dmalen;
+    int dmaecho;
     // Should echo back received chars?
     enum ONOFF echo;
+    // Canonical mode: on INTerrupt mode, the Rx ISR edits the input
+    // line by line, and only puts complete lines (ending in \n) in ibuf
+    enum ONOFF canon;
+    // Line being edited by the Rx ISR, and its backing buffer
+    struct ldisc ld;
+    char lbuf[UART_LINE_MAX];
+    // Complete lines put in ibuf (by the Rx ISR)
+    volatile unsigned int lines;
+    // Complete lines taken from ibuf (by uart_readline)
+    unsigned int linesrd;
+    // Are the hardware FIFOs enabled?
+    enum ONOFF fifo;
+    // Is auto flow control enabled?
+    enum ONOFF afc;
+    // With auto flow control, set to 1 by the Rx ISR when it stops
+    // draining the Rx FIFO, cleared by the reader
+    volatile int throttled;
+#ifdef UART_BENCH
+    // Cost of the Rx/Tx ISRs, in clock ticks
+    struct uisrstats rxisr;
+    struct uisrstats txisr;
+#endif
 };
 
 // Board has two UART ports
@@ -35,6 +152,16 @@ void Uart0_TxInt(void) __attribute__ ((interrupt ("IRQ")));
 void Uart1_RxInt(void) __attribute__ ((interrupt ("IRQ")));
 void Uart1_TxInt(void) __attribute__ ((interrupt ("IRQ")));
 
+// ISR functions for BDMA transfer completion
+void Bdma0_Int(void) __attribute__ ((interrupt ("IRQ")));
+void Bdma1_Int(void) __attribute__ ((interrupt ("IRQ")));
+
+// ISR function for Rx errors, shared by both ports
+void Uart_ErrInt(void) __attribute__ ((interrupt ("IRQ")));
+
+// Starts the next DMA tx transfer, also used by uart_echo
+static void uart_dma_kick(enum UART port);
+
 void uart_init(void) {
     int i;
 
@@ -44,8 +171,30 @@ void uart_init(void) {
         uport[i].txmode = DIS;
         uport[i].rP = 0;
         uport[i].wP = 0;
-        uport[i].sendP = NULL;
+        uport[i].overflows = 0;
+        uport[i].hwm = 0;
+        uport[i].overrun = 0;
+        uport[i].parity = 0;
+        uport[i].frame = 0;
+        uport[i].brk = 0;
+        uport[i].errdrop = OFF;
+        uport[i].errdrops = 0;
+        uport[i].orP = 0;
+        uport[i].owP = 0;
+        uport[i].erP = 0;
+        uport[i].ewP = 0;
+        uport[i].dmabusy = 0;
         uport[i].echo = OFF;
+        uport[i].canon = OFF;
+        uport[i].ld.buf = uport[i].lbuf;
+        uport[i].ld.len = 0;
+        uport[i].ld.max = UART_LINE_MAX;
+        uport[i].ld.last = 0;
+        uport[i].lines = 0;
+        uport[i].linesrd = 0;
+        uport[i].fifo = OFF;
+        uport[i].afc = OFF;
+        uport[i].throttled = 0;
     }
 
     // If set on INTerrupt mode, we need to register our ISR
@@ -54,6 +203,12 @@ void uart_init(void) {
     pISR_URXD1 = (int) Uart1_RxInt;
     pISR_UTXD1 = (int) Uart1_TxInt;
 
+    // On DMA mode, BDMA0 serves UART0 and BDMA1 serves UART1
+    pISR_BDMA0 = (int) Bdma0_Int;
+    pISR_BDMA1 = (int) Bdma1_Int;
+
+    pISR_UERR01 = (int) Uart_ErrInt;
+
     // UART_0 rx/tx lines
     ic_conf_line(INT_URXD0, IRQ);
     ic_conf_line(INT_UTXD0, IRQ);
@@ -61,17 +216,59 @@ void uart_init(void) {
     // UART_1 rx/tx lines
     ic_conf_line(INT_URXD1, IRQ);
     ic_conf_line(INT_UTXD1, IRQ);
+
+    // BDMA terminal count lines
+    ic_conf_line(INT_BDMA0, IRQ);
+    ic_conf_line(INT_BDMA1, IRQ);
+
+    // Error line for both ports, it will only be raised by ports
+    // with rx enabled (see uart_conf_rxmode)
+    ic_conf_line(INT_UERR01, IRQ);
+    ic_enable(INT_UERR01);
+}
+
+// Compute the divisor for the given baud rate, and the rate
+// (and error) we would really get with it.
+// Returns -1 if the rate can't be obtained within UART_BAUD_TOL
+int uart_baud(int baud, struct ubaud *res) {
+    int error;
+
+    // Smallest divisor is 0 (MCLK / 16), largest is 0xFFFF (16 bits)
+    if (baud <= 0 || baud > MCLK / 16) {
+        return -1;
+    }
+
+    res->div = UART_BRDIV(baud);
+    if (res->div > 0xFFFF) {
+        return -1;
+    }
+
+    res->actual = MCLK / (16 * (res->div + 1));
+    // Difference can be large for very high rates, avoid the overflow
+    error = (int) (((long long) (res->actual - baud) * 10000) / baud);
+    res->error = error;
+
+    if (error > UART_BAUD_TOL || error < -UART_BAUD_TOL) {
+        return -1;
+    }
+
+    return 0;
 }
 
 // Setup given uart port with the ulconf and the appropriate GPIO ports
 // RX and TX lines should be set as functional pins, outputting the signal
 // into the DB9 connectors of the board
 int uart_lconf(enum UART port, struct ulconf *lconf) {
-    int baud_rate;
+    struct ubaud baud;
     // Will mask here all the values, then store directly on ULCONn
     unsigned int confvalue = 0;
+    // FIFO configuration, stored directly on UFCONn
+    unsigned int fifovalue = 0;
 
-    baud_rate = (int)( MCLK /(16.0 * lconf->baud) + 0.5) - 1;
+    // Refuse rates we can't generate accurately enough
+    if (uart_baud(lconf->baud, &baud) != 0) {
+        return -1;
+    }
 
     if (lconf->ired == ON) {
         confvalue |= 0x1 << 6;
@@ -122,23 +319,61 @@ int uart_lconf(enum UART port, struct ulconf *lconf) {
             return -1;
     }
 
+    // Auto flow control only works together with the FIFO
+    if (lconf->afc == ON && lconf->fifo != ON) {
+        return -1;
+    }
+
+    // UFCONn[0] enables the FIFOs, [1] and [2] reset the Rx/Tx FIFOs
+    // (auto-cleared), [5:4] is the Rx trigger level, [7:6] the Tx one
+    if (lconf->fifo == ON) {
+        if (lconf->rxtrig < RXTRIG4 || lconf->rxtrig > RXTRIG16) {
+            return -1;
+        }
+
+        if (lconf->txtrig < TXTRIG0 || lconf->txtrig > TXTRIG12) {
+            return -1;
+        }
+
+        fifovalue = 0x1 | (0x1 << 1) | (0x1 << 2)
+                  | (lconf->rxtrig << 4)
+                  | (lconf->txtrig << 6);
+    }
+
     switch (port) {
         case UART0:
             rULCON0 = confvalue;
-            rUBRDIV0 = baud_rate;
+            rUFCON0 = fifovalue;
+            rUBRDIV0 = baud.div;
             // Enable signal output mode in Port E
             // rPCONE[5:4] is RxD0, rPCONE[3:2] is TxD0
             // Set them to 0, then flip the bits to 10
             rPCONE = (rPCONE & ~(0xF << 2)) | (0x2 << 2) | (0x2 << 4);
+            // rUMCONn[4] enables AFC
+            // rPCONC[31:30] is nCTS0, rPCONC[29:28] is nRTS0
+            if (lconf->afc == ON) {
+                rUMCON0 = 0x1 << 4;
+                rPCONC = rPCONC | (0xF << 28);
+            } else {
+                rUMCON0 = 0x0;
+            }
             break;
 
         case UART1:
             rULCON1 = confvalue;
-            rUBRDIV1 = baud_rate;
+            rUFCON1 = fifovalue;
+            rUBRDIV1 = baud.div;
             // Enable signal output mode in Port C
             // rPCONC[27:26] is RxD1, rPCONC[25:24] is TxD1
             // writing 0b1111 to pos 24 writes to both at once
             rPCONC = rPCONC | (0xF << 24);
+            // rPCONC[23:22] is nCTS1, rPCONC[21:20] is nRTS1
+            if (lconf->afc == ON) {
+                rUMCON1 = 0x1 << 4;
+                rPCONC = rPCONC | (0xF << 20);
+            } else {
+                rUMCON1 = 0x0;
+            }
             break;
 
         default:
@@ -146,6 +381,10 @@ int uart_lconf(enum UART port, struct ulconf *lconf) {
     }
 
     uport[port].echo = lconf->echo;
+    uport[port].canon = lconf->canon;
+    uport[port].errdrop = lconf->errdrop;
+    uport[port].fifo = lconf->fifo;
+    uport[port].afc = lconf->afc;
 
     return 0;
 }
@@ -160,6 +399,16 @@ int uart_conf_txmode(enum UART port, enum URxTxMode mode) {
     if (port < 0 || port > 1)
         return -1;
 
+    // Rx and Tx share the port BDMA channel, only one of them can use it
+    if (mode == DMA && uport[port].rxmode == DMA)
+        return -1;
+
+    // Let the rings queued on INTerrupt or DMA mode go out first,
+    // the new mode won't drain them
+    if (mode != uport[port].txmode
+            && (uport[port].txmode == INT || uport[port].txmode == DMA))
+        uart_flush(port);
+
     switch (mode) {
         case POLL: // fallthrough
         case INT:
@@ -177,14 +426,21 @@ int uart_conf_txmode(enum UART port, enum URxTxMode mode) {
 
     // Clear bits [3:2], then set them to `conf`
     // Set rUCONn[9] to 1 for tx interrupt mode level (0 is Pulse)
+    // Also, if mode is DMA, enable the BDMA completion line
     switch (port) {
         case UART0:
             // FIXME(borja): Not setting bits [3:2] for some reason
             rUCON0 = (rUCON0 & ~(0x3 << 2)) | (conf << 2) | (0x1 << 9);
+            if (mode == DMA) {
+                ic_enable(INT_BDMA0);
+            }
             break;
 
         case UART1:
             rUCON1 = (rUCON1 & ~(0x3 << 2)) | (conf << 2) | (0x1 << 9);
+            if (mode == DMA) {
+                ic_enable(INT_BDMA1);
+            }
             break;
     }
 
@@ -193,6 +449,43 @@ int uart_conf_txmode(enum UART port, enum URxTxMode mode) {
     return 0;
 }
 
+// Program the port BDMA channel to copy every received byte into ibuf
+// The channel auto-reloads at the end of ibuf, so it keeps writing
+// the ring in circles, without raising any interrupt.
+static void uart_dma_recv_start(enum UART port) {
+    struct port_stat *pst = &uport[port];
+    // Source: byte-sized [31:30] = 00, fixed address [29:28] = 11
+    unsigned int src = (0x3 << 28);
+    // Destination: IO to memory [31:30] = 10, incrementing address [29:28] = 01
+    unsigned int dst = (0x2 << 30) | (0x1 << 28)
+                     | ((unsigned int) pst->ibuf & 0x0FFFFFFF);
+    // Count: UART request source [31:30] = 01, unit transfer [27:26] = 01,
+    // polling mode [23:22] = 00, auto-reload [21] = 1
+    unsigned int cnt = (0x1 << 30) | (0x1 << 26) | (0x1 << 21) | UART_BUFLEN;
+
+    pst->rP = 0;
+    pst->wP = 0;
+
+    switch (port) {
+        case UART0:
+            rBDCON0 = 0x0;
+            rBDISRC0 = src | URXH0;
+            rBDIDES0 = dst;
+            rBDICNT0 = cnt;
+            // rBDICNTn[20] enables the channel, only after the count is set
+            rBDICNT0 |= (0x1 << 20);
+            break;
+
+        case UART1:
+            rBDCON1 = 0x0;
+            rBDISRC1 = src | URXH1;
+            rBDIDES1 = dst;
+            rBDICNT1 = cnt;
+            rBDICNT1 |= (0x1 << 20);
+            break;
+    }
+}
+
 // Configure the given port rx mode
 int uart_conf_rxmode(enum UART port, enum URxTxMode mode) {
     int conf = 0;
@@ -203,31 +496,61 @@ int uart_conf_rxmode(enum UART port, enum URxTxMode mode) {
     if (port < 0 || port > 1)
         return -1;
 
+    // Rx and Tx share the port BDMA channel, only one of them can use it
+    if (mode == DMA && uport[port].txmode == DMA)
+        return -1;
+
+    // With the FIFO enabled, set rUCONn[7] (Rx time out) so that
+    // bytes sitting below the trigger level still raise an interrupt
+    if (uport[port].fifo == ON) {
+        conf |= 0x1 << 7;
+    }
+
+    // rUCONn[6] raises the error interrupt on overrun, parity,
+    // frame and break errors
+    conf |= 0x1 << 6;
+
     switch (mode) {
         case POLL: // fallthrough
         case INT:
-            conf = 0x1;
+            conf |= 0x1;
             break;
         case DMA:
-            conf = (port == UART0) ? 0x2 : 0x3;
+            conf |= (port == UART0) ? 0x2 : 0x3;
             break;
         default:
             conf = 0;
     }
 
-    // Clear bits [1:0], then set them to `conf`
-    // Clear rUCONn[0] (0) for rx interrupt mode pulse (1 is level)
+    // On DMA mode, the BDMA channel must be ready before the UART
+    // starts raising requests
+    if (mode == DMA) {
+        uart_dma_recv_start(port);
+    }
+
+    // Leaving DMA mode, stop the auto-reloading channel so it doesn't
+    // keep writing over the rx ring
+    if (mode != DMA && uport[port].rxmode == DMA) {
+        if (port == UART0) {
+            rBDICNT0 &= ~(0x1 << 20);
+        } else {
+            rBDICNT1 &= ~(0x1 << 20);
+        }
+    }
+
+    // Clear bits [1:0], [6] and [7], then set them to `conf`
+    // Clear rUCONn[8] (0) for rx interrupt mode pulse (1 is level)
     // Also, if mode is interrupt, enable the line
     switch (port) {
         case UART0:
-            rUCON0 = (rUCON0 & ~((0x1 << 8) | 0x3)) | conf;
+            rUCON0 = (rUCON0 & ~((0x1 << 8) | (0x3 << 6) | 0x3)) | conf;
             if (mode == INT) {
                 ic_enable(INT_URXD0);
             }
             break;
 
         case UART1:
-            rUCON1 = (rUCON1 & ~((0x1 << 8) | 0x3)) | conf;
+            rUCON1 = (rUCON1 & ~((0x1 << 8) | (0x3 << 6) | 0x3)) | conf;
             if (mode == INT) {
                 ic_enable(INT_URXD1);
             }
@@ -239,39 +562,57 @@ int uart_conf_rxmode(enum UART port, enum URxTxMode mode) {
     return 0;
 }
 
-// Blocking function until the given port has received data
-static void uart_rx_ready(enum UART port) {
+// Number of received bytes waiting to be read from the port
+static int uart_rx_count(enum UART port) {
+    unsigned int stat;
+
+    if (uport[port].fifo == ON) {
+        // rUFSTATn[8] is set when the Rx FIFO is full,
+        // otherwise rUFSTATn[3:0] holds the Rx FIFO count
+        stat = (port == UART0) ? rUFSTAT0 : rUFSTAT1;
+        if (stat & (0x1 << 8)) {
+            return FIFO_DEPTH;
+        }
+
+        return (stat & 0xF);
+    }
+
     // rUTRSTATn[0] is set to 1
     // when the received buffer has received data
-    // XXX(borja): Only valid if FIFO is disabled
-    // If enabled, check rUFSTATn
-    switch (port) {
-        case UART0:
-            while ((rUTRSTAT0 & 1) == 0);
-            break;
+    stat = (port == UART0) ? rUTRSTAT0 : rUTRSTAT1;
+    return (stat & 1);
+}
 
-        case UART1:
-            while ((rUTRSTAT1 & 1) == 0);
-            break;
+// Number of bytes that can be written to the port without overrunning it
+static int uart_tx_room(enum UART port) {
+    unsigned int stat;
+
+    if (uport[port].fifo == ON) {
+        // rUFSTATn[9] is set when the Tx FIFO is full,
+        // otherwise rUFSTATn[7:4] holds the Tx FIFO count
+        stat = (port == UART0) ? rUFSTAT0 : rUFSTAT1;
+        if (stat & (0x1 << 9)) {
+            return 0;
+        }
+
+        return FIFO_DEPTH - ((stat >> 4) & 0xF);
     }
-}
 
-// Blocking function until the given port has sent data
-// (tx buffer empty)
-static void uart_tx_ready(enum UART port) {
     // rUTRSTATn[1] is set to 1
     // when the transmit buffer is empty
-    // XXX(borja): Only valid if FIFO is disabled
-    // If enabled, check rUFSTATn
-    switch (port) {
-        case UART0:
-            while ((rUTRSTAT0 & 2) == 0);
-            break;
+    stat = (port == UART0) ? rUTRSTAT0 : rUTRSTAT1;
+    return ((stat & 2) >> 1);
+}
 
-        case UART1:
-            while ((rUTRSTAT1 & 2) == 0);
-            break;
-    }
+// Blocking function until the given port has received data
+static void uart_rx_ready(enum UART port) {
+    while (uart_rx_count(port) == 0);
+}
+
+// Blocking function until the given port can send data
+// (tx buffer empty, or room in the tx FIFO)
+static void uart_tx_ready(enum UART port) {
+    while (uart_tx_room(port) == 0);
 }
 
 // Write the given char in the BDMA zone (DMA) / register (INT/POLL) of the port
@@ -283,8 +624,41 @@ static void uart_write(enum UART port, char c) {
     }
 }
 
+// Transmit `c` back, without ever blocking (we might be in the Rx ISR)
+// On INTerrupt tx mode, queue it on the echo ring for the Tx ISR to send.
+// On DMA tx mode, a BDMA transfer in flight owns the Tx holding register
+// (writing to it would put `c` in the middle of the stream), so queue it
+// on the echo ring too, it's sent as a transfer of its own once the
+// current one ends (see uart_dma_kick).
+// Otherwise, write it only if the transmitter has room.
+// If there's no room, the echo is dropped.
+static void uart_echo(enum UART port, char c) {
+    struct port_stat *pst = &uport[port];
+
+    if (pst->txmode == INT || (pst->txmode == DMA &&
+            (pst->dmabusy == 1 || pst->erP != pst->ewP))) {
+        if (pst->ewP - pst->erP == EBUFLEN) {
+            return;
+        }
+
+        pst->ebuf[pst->ewP & EBUFMASK] = c;
+        pst->ewP++;
+        if (pst->txmode == INT) {
+            ic_enable((port == UART0) ? INT_UTXD0 : INT_UTXD1);
+        } else if (pst->rxmode != INT) {
+            // Not in the Rx ISR (POLL rx mode), so the transfer
+            // may have ended before the push, and the BDMA ISR
+            // wouldn't see it. Send it from here then.
+            uart_dma_kick(port);
+        }
+    } else if (uart_tx_room(port) > 0) {
+        uart_write(port, c);
+    }
+}
+
 // Read directly off BDMA zone (DMA) / register (INT/POLL) of the port
-// If echo is enabled, immediately transmit it back
+// If echo is enabled, transmit it back
+// (on canonical mode, the line discipline takes care of echo)
 static char uart_read(enum UART port) {
     char c;
 
@@ -294,29 +668,171 @@ static char uart_read(enum UART port) {
         c = RdURXH1();
     }
 
-    if (uport[port].echo == ON) {
-        // Block until tx is ready
-        uart_tx_ready(port);
-        uart_write(port, c);
+    if (uport[port].echo == ON && uport[port].canon == OFF) {
+        uart_echo(port, c);
     }
 
     return c;
 }
 
+// Feed `c` into the line being edited on `ld`
+// Returns 1 once the line is complete, 0 otherwise
+//
+// \r, \n and \r\n all end a line. Backspace (or DEL) erases the last
+// char of the line, chars past the max line length are dropped.
+// If echo is enabled, echo back the edited line, so the terminal
+// shows what the line really holds.
+static int uart_ldisc(enum UART port, struct ldisc *ld, char c) {
+    int echo = (uport[port].echo == ON && uport[port].canon == ON);
+    char last = ld->last;
+
+    ld->last = c;
+
+    switch (c) {
+        case '\n':
+            // Second half of a \r\n, the line was done on \r
+            if (last == '\r') {
+                return 0;
+            }
+            // fallthrough
+        case '\r':
+            if (echo) {
+                uart_echo(port, '\r');
+                uart_echo(port, '\n');
+            }
+            return 1;
+
+        case '\b':
+        case 0x7F:
+            if (ld->len > 0) {
+                ld->len--;
+                if (echo) {
+                    uart_echo(port, '\b');
+                    uart_echo(port, ' ');
+                    uart_echo(port, '\b');
+                }
+            }
+            return 0;
+
+        default:
+            if (ld->len < ld->max) {
+                ld->buf[ld->len++] = c;
+                if (echo) {
+                    uart_echo(port, c);
+                }
+            }
+            return 0;
+    }
+}
+
+// Copy the line edited by the Rx ISR, plus a \n, at `*wP` in ibuf,
+// and advance `*wP` past it (not published yet)
+// If it doesn't fit, the whole line is dropped and counted as overflow
+// Returns 1 if the line was copied, 0 if it was dropped
+static int uart_commitline(enum UART port, unsigned int *wP) {
+    int i;
+    int committed = 0;
+    struct port_stat *pst = &uport[port];
+    struct ldisc *ld = &pst->ld;
+
+    if ((int) (UART_BUFLEN - (*wP - pst->rP)) < ld->len + 1) {
+        pst->overflows += ld->len + 1;
+    } else {
+        for (i = 0; i < ld->len; i++) {
+            pst->ibuf[*wP & BUFMASK] = ld->buf[i];
+            (*wP)++;
+        }
+        pst->ibuf[*wP & BUFMASK] = '\n';
+        (*wP)++;
+        committed = 1;
+    }
+
+    ld->len = 0;
+    return committed;
+}
+
 // Read from the port into the ring buffer
 // Called by Rx ISR, so no need to wait for data on buffer,
-// we already know it's there.
+// we already know it's there. On FIFO mode, drain every byte
+// in the Rx FIFO, so we take a single interrupt per burst.
+//
+// If the ring is full, the byte is dropped and counted as an overflow,
+// unread data is never overwritten.
+//
+// On canonical mode, bytes go through the line discipline instead,
+// and only complete lines are put in the ring.
 //
-// Will block if echo mode is enabled, wait till tx is ready
-static void uart_readtobuf(enum UART port) {
+// With auto flow control, only drain as many bytes as fit in the ring.
+// Once it's nearly full, mask the Rx line and leave the rest in the FIFO:
+// as the FIFO fills up, the UART deasserts nRTS and the sender stops.
+// The reader unmasks the line once it has made room.
+//
+static int uart_readtobuf(enum UART port) {
     char c;
+    int count;
+    int read;
+    unsigned int level;
+    unsigned int lines = 0;
+    struct port_stat *pst = &uport[port];
+    unsigned int wP = pst->wP;
+
+    count = uart_rx_count(port);
+    if (pst->afc == ON && count > (int) (UART_BUFLEN - (wP - pst->rP))) {
+        count = UART_BUFLEN - (wP - pst->rP);
+    }
+    read = count;
+
+    // Read from port and write it to the ring
+    for (; count > 0; count--) {
+        c = uart_read(port);
+        if (pst->canon == ON) {
+            // Only count the lines that made it into the ring
+            if (uart_ldisc(port, &pst->ld, c) == 1) {
+                lines += uart_commitline(port, &wP);
+            }
+            continue;
+        }
+
+        if (wP - pst->rP == UART_BUFLEN) {
+            pst->overflows++;
+            continue;
+        }
+
+        pst->ibuf[wP & BUFMASK] = c;
+        wP++;
+    }
+
+    // Publish all the new bytes (and lines) at once
+    pst->wP = wP;
+    pst->lines += lines;
+
+    level = wP - pst->rP;
+    if (level > pst->hwm) {
+        pst->hwm = level;
+    }
+
+    if (pst->afc == ON && level >= AFC_HIGH) {
+        pst->throttled = 1;
+        ic_disable((port == UART0) ? INT_URXD0 : INT_URXD1);
+    }
+
+    return read;
+}
+
+// Called by the reader after taking bytes off the ring buffer
+// If the Rx ISR stopped draining the FIFO (auto flow control) and there's
+// room again, drain it from here: the Rx line is masked, so the ISR
+// can't race us. Only unmask the line if that didn't fill the ring again.
+static void uart_unthrottle(enum UART port) {
     struct port_stat *pst = &uport[port];
 
-    // Read from port (this function will block on echo)
-    // and write it to the ring
-    c = uart_read(port);
-    pst->ibuf[pst->wP] = c;
-    pst->wP = (pst->wP + 1) % BUFLEN;
+    if (pst->throttled == 1 && pst->wP - pst->rP <= AFC_LOW) {
+        pst->throttled = 0;
+        uart_readtobuf(port);
+        if (pst->throttled == 0) {
+            ic_enable((port == UART0) ? INT_URXD0 : INT_URXD1);
+        }
+    }
 }
 
 // Read from the ring buffer
@@ -330,11 +846,114 @@ static char uart_readfrombuf(enum UART port) {
     // Wait until ring buffer is not empty
     while (pst->rP == pst->wP);
 
-    data = pst->ibuf[pst->rP];
-    pst->rP = (pst->rP + 1) % BUFLEN;
+    data = pst->ibuf[pst->rP & BUFMASK];
+    pst->rP++;
+
+    uart_unthrottle(port);
+
     return data;
 }
 
+// Refresh the ring write pointer from the BDMA current destination
+// Only valid on DMA rx mode
+//
+// The channel only tells us where it is inside ibuf, so we advance wP
+// by the distance it moved since the last call. If the reader falls
+// a full ring behind, the lap can't be seen, and the data is lost
+// without counting it as an overflow.
+static void uart_dma_syncwp(enum UART port) {
+    unsigned int cdes;
+    unsigned int level;
+    struct port_stat *pst = &uport[port];
+
+    cdes = (port == UART0) ? rBDCDES0 : rBDCDES1;
+    cdes = (cdes & 0x0FFFFFFF) - ((unsigned int) pst->ibuf & 0x0FFFFFFF);
+
+    // Right before the auto-reload, cdes points past the end of ibuf,
+    // masking it takes care of that too
+    pst->wP += (cdes - pst->wP) & BUFMASK;
+
+    level = pst->wP - pst->rP;
+    if (level > pst->hwm) {
+        pst->hwm = level;
+    }
+}
+
+// Called with the BDMA ring empty
+// If the port FIFO is enabled, the UART only raises a BDMA request
+// once the Rx FIFO reaches its trigger level. If the ring stays empty
+// while there are bytes in the FIFO (the line went idle in the middle
+// of a burst), they have to be read directly off the port. Since the
+// ring is empty at that point, this can't reorder the input.
+// Returns 1 if the ring stayed empty for IDLE_SPINS polls, with bytes
+// waiting in the FIFO. Returns 0 as soon as the FIFO is empty or the
+// channel writes to the ring.
+static int uart_dma_idle(enum UART port) {
+    int spins;
+    struct port_stat *pst = &uport[port];
+
+    for (spins = 0; spins < IDLE_SPINS; spins++) {
+        if (uart_rx_count(port) == 0) {
+            return 0;
+        }
+
+        uart_dma_syncwp(port);
+        if (pst->rP != pst->wP) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Read from the ring buffer the BDMA channel writes to
+// Block until the channel has written at least one value,
+// or read the FIFO residue directly (see uart_dma_idle).
+static char uart_dma_readfrombuf(enum UART port) {
+    char data;
+    struct port_stat *pst = &uport[port];
+
+    uart_dma_syncwp(port);
+    while (pst->rP == pst->wP) {
+        if (uart_dma_idle(port)) {
+            return uart_read(port);
+        }
+
+        uart_dma_syncwp(port);
+    }
+
+    data = pst->ibuf[pst->rP & BUFMASK];
+    pst->rP++;
+
+    // No ISR sees the bytes the BDMA channel reads, echo them from here
+    if (pst->echo == ON && pst->canon == OFF) {
+        uart_echo(port, data);
+    }
+
+    return data;
+}
+
+#ifdef UART_BENCH
+// Account an ISR call that started at clock count `start`
+// and moved `bytes` bytes. The clock timer counts down.
+static void uart_isr_account(struct uisrstats *st, unsigned int start, int bytes) {
+    unsigned int ticks = (start - clock_stamp()) & 0xFFFF;
+
+    st->calls++;
+    st->bytes += bytes;
+    st->ticks += ticks;
+    if (ticks > st->worst) {
+        st->worst = ticks;
+    }
+}
+
+#define ISR_START() unsigned int isr_start = clock_stamp()
+#define ISR_END(st, bytes) uart_isr_account(&(st), isr_start, (bytes))
+#else
+#define ISR_START()
+#define ISR_END(st, bytes) (void) (bytes)
+#endif
+
 // Rx ISR on port 0
 // This interrupt is raised whenever
 // the receive shift register is filled with data
@@ -342,8 +961,9 @@ static char uart_readfrombuf(enum UART port) {
 // FIXME(borja): Not called again
 // Transmit shifter not emptied, when is an interrupt raised?
 void Uart0_RxInt(void) {
+    ISR_START();
     // Write it to the ring buffer
-    uart_readtobuf(UART0);
+    ISR_END(uport[UART0].rxisr, uart_readtobuf(UART0));
     ic_cleanflag(INT_URXD0);
 }
 
@@ -351,45 +971,177 @@ void Uart0_RxInt(void) {
 // This interrupt is raised whenever
 // the receive shift register is filled with data
 void Uart1_RxInt(void) {
-    uart_readtobuf(UART1);
+    ISR_START();
+    ISR_END(uport[UART1].rxisr, uart_readtobuf(UART1));
     ic_cleanflag(INT_URXD1);
 }
 
-// Called by the Tx ISR. Should send the port_start->sendP
-// string one byte at a time.
-// As soon as the entire string is sent, disable interrupts and signal
-// caller that we're done.
-static void uart_dotxint(enum UART port) {
-    enum int_line target_line;
+// Program the port BDMA channel to send `len` bytes from `buf`
+// to the Tx holding register, one byte per UART request.
+// The BDMA ISR will set dmabusy to 0 on terminal count.
+static void uart_dma_start(enum UART port, const char *buf, int len) {
+    // Source: byte-sized, incrementing address [31:30] = 00, [29:28] = 01
+    unsigned int src = (0x1 << 28) | ((unsigned int) buf & 0x0FFFFFFF);
+    // Destination: memory to IO [31:30] = 01, fixed address [29:28] = 11
+    unsigned int dst = (0x1 << 30) | (0x3 << 28);
+    // Count: UART request source [31:30] = 01, unit transfer [27:26] = 01,
+    // interrupt on terminal count [23:22] = 11
+    unsigned int cnt = (0x1 << 30) | (0x1 << 26) | (0x3 << 22) | len;
+
+    uport[port].dmabusy = 1;
+
+    switch (port) {
+        case UART0:
+            rBDCON0 = 0x0;
+            rBDISRC0 = src;
+            rBDIDES0 = dst | UTXH0;
+            rBDICNT0 = cnt;
+            // rBDICNTn[20] enables the channel, only after the count is set
+            rBDICNT0 |= (0x1 << 20);
+            break;
+
+        case UART1:
+            rBDCON1 = 0x0;
+            rBDISRC1 = src;
+            rBDIDES1 = dst | UTXH1;
+            rBDICNT1 = cnt;
+            rBDICNT1 |= (0x1 << 20);
+            break;
+    }
+}
+
+// On DMA mode, start sending the tx ring if the BDMA channel is idle
+// Each transfer takes the bytes up to the end of obuf, the BDMA ISR
+// starts the next one (if any), so the writer never waits on the channel.
+// Echoed bytes left on the echo ring go out first (as on INTerrupt mode),
+// as a transfer of their own: the Tx holding register may still be full
+// right after a transfer, and its terminal count brings us back here.
+// Called by the writer only while dmabusy is 0 (so the ISR can't run),
+// and by the BDMA ISR.
+static void uart_dma_kick(enum UART port) {
+    unsigned int off;
+    unsigned int len;
     struct port_stat *pst = &uport[port];
 
-    if (*pst->sendP != '\0' ) {
-        if (*pst->sendP == '\n') {
-            // \n -> \r\n conversion for windows
-            // Then block until tx is ready again
-            // (this would raise an interrupt, but we don't care)
-            uart_write(port, '\r');
-            uart_tx_ready(port);
+    if (pst->dmabusy == 1) {
+        return;
+    }
+
+    if (pst->erP != pst->ewP) {
+        off = pst->erP & EBUFMASK;
+        len = pst->ewP - pst->erP;
+        if (len > EBUFLEN - off) {
+            len = EBUFLEN - off;
         }
 
-        uart_write(port, *pst->sendP);
-        pst->sendP++;
+        pst->dmalen = len;
+        pst->dmaecho = 1;
+        uart_dma_start(port, (const char *) &pst->ebuf[off], len);
+        return;
+    }
+
+    if (pst->orP == pst->owP) {
+        return;
+    }
+
+    off = pst->orP & OBUFMASK;
+    len = pst->owP - pst->orP;
+    if (len > UART_OBUFLEN - off) {
+        len = UART_OBUFLEN - off;
     }
 
-    // When we're done, disable Tx interrupts, and signal caller
-    // by flipping the send char array to NULL
-    if (*pst->sendP == '\0') {
+    pst->dmalen = len;
+    pst->dmaecho = 0;
+    uart_dma_start(port, (const char *) &pst->obuf[off], len);
+}
+
+// Called by the BDMA ISR, on terminal count
+// Release the bytes just sent, and send the rest of the echo and tx rings
+static void uart_dodmaint(enum UART port) {
+    struct port_stat *pst = &uport[port];
+
+    if (pst->dmaecho == 1) {
+        pst->erP += pst->dmalen;
+    } else {
+        pst->orP += pst->dmalen;
+    }
+    pst->dmabusy = 0;
+    uart_dma_kick(port);
+}
+
+// BDMA0 ISR, raised on terminal count of a UART0 transfer
+void Bdma0_Int(void) {
+    uart_dodmaint(UART0);
+    ic_cleanflag(INT_BDMA0);
+}
+
+// BDMA1 ISR, raised on terminal count of a UART1 transfer
+void Bdma1_Int(void) {
+    uart_dodmaint(UART1);
+    ic_cleanflag(INT_BDMA1);
+}
+
+// Push `c` into the tx ring of the port, the Tx (or BDMA) ISR will send it
+// Block only if the ring is full, until the ISR makes room
+static void uart_txpush(enum UART port, char c) {
+    struct port_stat *pst = &uport[port];
+
+    if (pst->owP - pst->orP == UART_OBUFLEN) {
+        // Make sure the ISR is draining the ring before waiting on it
+        if (pst->txmode == DMA) {
+            uart_dma_kick(port);
+        } else {
+            ic_enable((port == UART0) ? INT_UTXD0 : INT_UTXD1);
+        }
+        while (pst->owP - pst->orP == UART_OBUFLEN);
+    }
+
+    pst->obuf[pst->owP & OBUFMASK] = c;
+    pst->owP++;
+}
+
+// Called by the Tx ISR. Should send the contents of the echo and tx rings,
+// as many bytes as the transmitter can take
+// (one byte, or up to the free space in the Tx FIFO).
+// As soon as both rings are empty, disable interrupts, they will be
+// enabled again by the next writer.
+// Returns the number of bytes sent.
+static int uart_dotxint(enum UART port) {
+    int room;
+    int sent;
+    enum int_line target_line;
+    struct port_stat *pst = &uport[port];
+
+    room = uart_tx_room(port);
+    sent = room;
+
+    // Echoed bytes go first, they are what the user is waiting for
+    while (room > 0 && pst->erP != pst->ewP) {
+        uart_write(port, pst->ebuf[pst->erP & EBUFMASK]);
+        pst->erP++;
+        room--;
+    }
+
+    while (room > 0 && pst->orP != pst->owP) {
+        uart_write(port, pst->obuf[pst->orP & OBUFMASK]);
+        pst->orP++;
+        room--;
+    }
+
+    if (pst->orP == pst->owP && pst->erP == pst->ewP) {
         target_line = (port == UART0) ? INT_UTXD0 : INT_UTXD1;
         ic_disable(target_line);
-        pst->sendP = NULL;
     }
+
+    return sent - room;
 }
 
 // Tx ISR on port 0
 // This interrupt is raised whenever
 // the transmit shift register is flushed
 void Uart0_TxInt(void) {
-    uart_dotxint(UART0);
+    ISR_START();
+    ISR_END(uport[UART0].txisr, uart_dotxint(UART0));
     ic_cleanflag(INT_UTXD0);
 }
 
@@ -397,10 +1149,139 @@ void Uart0_TxInt(void) {
 // This interrupt is raised whenever
 // the transmit shift register is flushed
 void Uart1_TxInt(void) {
-    uart_dotxint(UART1);
+    ISR_START();
+    ISR_END(uport[UART1].txisr, uart_dotxint(UART1));
     ic_cleanflag(INT_UTXD1);
 }
 
+// Called by the error ISR. Count the errors reported by the port
+// (reading rUERSTATn clears it), and discard the corrupted byte
+// if the port is set to do so.
+//
+// The error line has a higher priority than the Rx lines, so we get here
+// before the Rx ISR reads the byte. With the FIFO enabled, the error
+// is reported for the byte at the head of the FIFO.
+static void uart_doerrint(enum UART port) {
+    unsigned int stat;
+    struct port_stat *pst = &uport[port];
+
+    // rUERSTATn[0] overrun, [1] parity, [2] frame, [3] break
+    stat = (port == UART0) ? rUERSTAT0 : rUERSTAT1;
+    if (stat == 0) {
+        return;
+    }
+
+    if (stat & 0x1) {
+        pst->overrun++;
+    }
+
+    if (stat & 0x2) {
+        pst->parity++;
+    }
+
+    if (stat & 0x4) {
+        pst->frame++;
+    }
+
+    if (stat & 0x8) {
+        pst->brk++;
+    }
+
+    // Read the corrupted byte off the port, without going through
+    // uart_read, we don't want it echoed either
+    if ((stat & 0x6) && pst->errdrop == ON && uart_rx_count(port) > 0) {
+        if (port == UART0) {
+            (void) RdURXH0();
+        } else {
+            (void) RdURXH1();
+        }
+        pst->errdrops++;
+    }
+}
+
+// Rx error ISR, shared by both ports
+void Uart_ErrInt(void) {
+    uart_doerrint(UART0);
+    uart_doerrint(UART1);
+    ic_cleanflag(INT_UERR01);
+}
+
+// Copy up to `size` bytes from the ring buffer into `buf`, without blocking
+// Returns the number of bytes copied
+static int uart_copyfrombuf(enum UART port, char *buf, int size) {
+    int i;
+    int count;
+    struct port_stat *pst = &uport[port];
+    unsigned int rP = pst->rP;
+
+    count = pst->wP - rP;
+    if (count > size) {
+        count = size;
+    }
+
+    for (i = 0; i < count; i++) {
+        buf[i] = pst->ibuf[rP & BUFMASK];
+        rP++;
+    }
+
+    // Release all the bytes at once
+    pst->rP = rP;
+
+    return count;
+}
+
+// Non-blocking function, reads whatever the port has received
+// (up to `size` bytes) into buf.
+// On DMA mode, bytes below the Rx FIFO trigger level take up to
+// IDLE_SPINS polls to show up.
+// Returns the number of bytes read, 0 if there was nothing to read
+int uart_getbuf(enum UART port, char *buf, int size) {
+    int i;
+    int count = 0;
+    struct port_stat *pst = &uport[port];
+
+    if (port < 0 || port > 1 || size < 0) {
+        return -1;
+    }
+
+    switch (pst->rxmode) {
+        case POLL:
+            while (count < size && uart_rx_count(port) > 0) {
+                buf[count++] = uart_read(port);
+            }
+            break;
+
+        case INT:
+            count = uart_copyfrombuf(port, buf, size);
+            uart_unthrottle(port);
+            break;
+
+        case DMA:
+            uart_dma_syncwp(port);
+            if (pst->rP == pst->wP && uart_dma_idle(port)) {
+                // Nothing on the ring, but bytes stuck below the Rx FIFO
+                // trigger level, take them off the port
+                while (count < size && uart_rx_count(port) > 0) {
+                    buf[count++] = uart_read(port);
+                }
+            } else {
+                count = uart_copyfrombuf(port, buf, size);
+            }
+            // No ISR sees the bytes the BDMA channel reads, echo them from here
+            if (pst->echo == ON && pst->canon == OFF) {
+                for (i = 0; i < count; i++) {
+                    uart_echo(port, buf[i]);
+                }
+            }
+            break;
+
+        default:
+            return -1;
+    }
+
+    return count;
+}
+
 // Blocking function, reads from UARt port into c
 int uart_getch(enum UART port, char *c) {
     if (port < 0 || port > 1) {
@@ -421,8 +1302,9 @@ int uart_getch(enum UART port, char *c) {
             break;
 
         case DMA:
-            // TODO(borja): Optional
-            return -1;
+            // If DMA mode, read from the ring buffer
+            // that the BDMA channel will put there
+            *c = uart_dma_readfrombuf(port);
             break;
 
         default:
@@ -432,11 +1314,8 @@ int uart_getch(enum UART port, char *c) {
     return 0;
 }
 
-// Blocking send the given char
+// Send the given char (blocking only on POLL mode)
 int uart_sendch(enum UART port, char c) {
-    // Used in interrupt mode, a valid C string (with \0 at the end)
-    char localB[2] = {0};
-
     if (port < 0 || port > 1) {
         return -1;
     }
@@ -455,14 +1334,67 @@ int uart_sendch(enum UART port, char c) {
             break;
 
         case INT:
-            // Under interrupt mode, send a one-byte string (plus \0)
-            localB[0] = c;
-            uart_send_str(port, localB);
+            // Under interrupt mode, queue it on the tx ring
+            if (c == '\n') {
+                uart_txpush(port, '\r');
+            }
+            uart_txpush(port, c);
+            ic_enable((port == UART0) ? INT_UTXD0 : INT_UTXD1);
             break;
 
         case DMA:
-            // TODO(borja): Optional
+            // Queue it on the tx ring, the BDMA channel sends it
+            if (c == '\n') {
+                uart_txpush(port, '\r');
+            }
+            uart_txpush(port, c);
+            uart_dma_kick(port);
+            break;
+
+        default:
             return -1;
+    }
+
+    return 0;
+}
+
+// Send `len` chars from `buf`, with \n -> \r\n conversion
+// Any byte is sent as is, including \0.
+static int uart_send_buf(enum UART port, const char *buf, int len) {
+    int i;
+    enum int_line target_line;
+
+    switch (uport[port].txmode) {
+        case POLL:
+            // Send the string byte by byte
+            for (i = 0; i < len; i++) {
+                uart_sendch(port, buf[i]);
+            }
+            break;
+
+        case INT:
+            // Queue the string on the tx ring, with \n -> \r\n
+            // conversion, then let the ISR send all the bytes
+            for (i = 0; i < len; i++) {
+                if (buf[i] == '\n') {
+                    uart_txpush(port, '\r');
+                }
+                uart_txpush(port, buf[i]);
+            }
+            target_line = (port == UART0) ? INT_UTXD0 : INT_UTXD1;
+            ic_enable(target_line);
+            break;
+
+        case DMA:
+            // Same as INTerrupt mode, but the BDMA channel drains the ring
+            // (the \r\n conversion happens on the way in)
+            for (i = 0; i < len; i++) {
+                if (buf[i] == '\n') {
+                    uart_txpush(port, '\r');
+                }
+                uart_txpush(port, buf[i]);
+            }
+            uart_dma_kick(port);
             break;
 
         default:
@@ -472,55 +1404,408 @@ int uart_sendch(enum UART port, char c) {
     return 0;
 }
 
-// Blocking send the given string (ends in \0)
+// Send the given string (ends in \0)
+// Blocking on POLL mode. On INTerrupt and DMA mode, the string is copied
+// to the tx ring, and we only block while the ring is full.
 int uart_send_str(enum UART port, char *str) {
-    enum int_line target_line;
-    struct port_stat *pst = &uport[port];
+    int len = 0;
 
     if (port < 0 || port > 1) {
         return -1;
     }
 
+    while (str[len] != '\0') {
+        len++;
+    }
+
+    return uart_send_buf(port, str, len);
+}
+
+// Send `len` raw bytes from `buf` (no \n -> \r\n conversion)
+// On INTerrupt and DMA mode, this doesn't wait for the bytes to go out,
+// they are queued on the tx ring, and we only block while the ring is full.
+// POLL mode is blocking.
+// Returns the number of bytes sent or queued.
+int uart_write_async(enum UART port, const char *buf, int len) {
+    int i;
+
+    if (port < 0 || port > 1 || len < 0) {
+        return -1;
+    }
 
     switch (uport[port].txmode) {
         case POLL:
-            // Send the string byte by byte
-            while (*str != '\0') {
-                uart_sendch(port, *str);
-                str++;
+            for (i = 0; i < len; i++) {
+                uart_tx_ready(port);
+                uart_write(port, buf[i]);
             }
             break;
 
         case INT:
-            // Point to the sender buffer, then wait until the ISR
-            // sends all the bytes
-            // The ISR will set sendP to NULL once it's done
-            pst->sendP = str;
-            target_line = (port == UART0) ? INT_UTXD0 : INT_UTXD1;
-            ic_enable(target_line);
-            while(pst->sendP != NULL);
+            for (i = 0; i < len; i++) {
+                uart_txpush(port, buf[i]);
+            }
+            ic_enable((port == UART0) ? INT_UTXD0 : INT_UTXD1);
             break;
 
         case DMA:
-            // TODO(borja): Optional
-            return -1;
+            for (i = 0; i < len; i++) {
+                uart_txpush(port, buf[i]);
+            }
+            uart_dma_kick(port);
             break;
 
         default:
             return -1;
     }
 
+    return len;
+}
+
+// Block until every queued byte has left the port
+int uart_flush(enum UART port) {
+    struct port_stat *pst = &uport[port];
+
+    if (port < 0 || port > 1) {
+        return -1;
+    }
+
+    // Wait for the ISR to drain the tx and echo rings
+    if (pst->txmode == INT) {
+        while (pst->orP != pst->owP || pst->erP != pst->ewP);
+    }
+
+    // Wait for the BDMA channel to send the tx ring, and finish
+    // the transfer in flight (echoed bytes go out in between)
+    if (pst->txmode == DMA) {
+        while (pst->orP != pst->owP || pst->erP != pst->ewP ||
+               pst->dmabusy == 1) {
+            uart_dma_kick(port);
+        }
+    }
+
+    // rUTRSTATn[2] is set to 1 when both the transmit buffer (or FIFO)
+    // and the transmit shifter are empty
+    if (port == UART0) {
+        while ((rUTRSTAT0 & 0x4) == 0);
+    } else {
+        while ((rUTRSTAT1 & 0x4) == 0);
+    }
+
+    return 0;
+}
+
+// Check, without blocking, if uart_readline would return right away
+// Only supported on canonical INTerrupt mode, returns -1 otherwise.
+// Returns 1 if there's a complete line waiting, 0 if not.
+int uart_line_ready(enum UART port) {
+    struct port_stat *pst = &uport[port];
+
+    if (port < 0 || port > 1) {
+        return -1;
+    }
+
+    if (pst->canon != ON || pst->rxmode != INT) {
+        return -1;
+    }
+
+    return (pst->lines != pst->linesrd);
+}
+
+// Read a line from the port into `buf`, without its terminator
+// At most `size` - 1 chars are stored (the rest of the line is dropped),
+// followed by a \0. Blocks until the line is complete.
+// Returns the length of the line stored in `buf`.
+//
+// On canonical INTerrupt mode, the line has already been edited
+// by the Rx ISR, so this is a single wait until the ISR signals
+// a complete line. Otherwise, edit the line here, byte by byte.
+int uart_readline(enum UART port, char *buf, int size) {
+    char c;
+    int len = 0;
+    struct ldisc ld;
+    struct port_stat *pst = &uport[port];
+
+    if (port < 0 || port > 1 || size < 1) {
+        return -1;
+    }
+
+    if (pst->canon == ON && pst->rxmode == INT) {
+        // The Rx ISR wakes us up. If the line lands right before
+        // we idle, the next interrupt does (at worst the wheel tick)
+        while (pst->lines == pst->linesrd) {
+            sleep_idle();
+        }
+
+        while ((c = uart_readfrombuf(port)) != '\n') {
+            if (len < size - 1) {
+                buf[len++] = c;
+            }
+        }
+        pst->linesrd++;
+    } else {
+        ld.buf = buf;
+        ld.len = 0;
+        ld.max = size - 1;
+        ld.last = pst->ld.last;
+
+        do {
+            if (uart_getch(port, &c) != 0) {
+                return -1;
+            }
+        } while (uart_ldisc(port, &ld, c) == 0);
+
+        pst->ld.last = ld.last;
+        len = ld.len;
+    }
+
+    buf[len] = '\0';
+    return len;
+}
+
+// Copy the rx statistics and error counters of the port into `st`
+int uart_stats(enum UART port, struct ustats *st) {
+    struct port_stat *pst = &uport[port];
+
+    if (port < 0 || port > 1) {
+        return -1;
+    }
+
+    st->overflows = pst->overflows;
+    st->hwm = pst->hwm;
+    st->overrun = pst->overrun;
+    st->parity = pst->parity;
+    st->frame = pst->frame;
+    st->brk = pst->brk;
+    st->errdrops = pst->errdrops;
+
+    return 0;
+}
+
+// Connect the Tx output of the port to its own Rx input (rUCONn[5])
+int uart_loopback(enum UART port, enum ONOFF mode) {
+    int conf = (mode == ON) ? (0x1 << 5) : 0;
+
+    if (port < 0 || port > 1) {
+        return -1;
+    }
+
+    switch (port) {
+        case UART0:
+            rUCON0 = (rUCON0 & ~(0x1 << 5)) | conf;
+            break;
+
+        case UART1:
+            rUCON1 = (rUCON1 & ~(0x1 << 5)) | conf;
+            break;
+    }
+
     return 0;
+}
+
+#ifdef UART_BENCH
+// Copy the Rx and Tx ISR costs of the port into `rx` and `tx`,
+// and reset them if `reset` is ON
+int uart_isrstats(enum UART port, struct uisrstats *rx,
+                  struct uisrstats *tx, enum ONOFF reset) {
+    struct port_stat *pst = &uport[port];
+
+    if (port < 0 || port > 1) {
+        return -1;
+    }
 
+    *rx = pst->rxisr;
+    *tx = pst->txisr;
+
+    if (reset == ON) {
+        pst->rxisr = (struct uisrstats) {0, 0, 0, 0};
+        pst->txisr = (struct uisrstats) {0, 0, 0, 0};
+    }
+
+    return 0;
 }
+#endif
+
+// Formatted output waiting to be sent by uart_printf
+struct pf_chunk {
+    enum UART port;
+    int len;
+    char buf[PRINTF_CHUNK];
+};
+
+// Send whatever is left on the chunk
+// Sent by length, a %c of '\0' is output like any other char.
+static void pf_flush(struct pf_chunk *ch) {
+    if (ch->len > 0) {
+        uart_send_buf(ch->port, ch->buf, ch->len);
+        ch->len = 0;
+    }
+}
+
+// Append `c` to the chunk, send it once full
+static void pf_putc(struct pf_chunk *ch, char c) {
+    ch->buf[ch->len++] = c;
+    if (ch->len == PRINTF_CHUNK) {
+        pf_flush(ch);
+    }
+}
+
+// Append `n` copies of `c` to the chunk
+static void pf_pad(struct pf_chunk *ch, char c, int n) {
+    for (; n > 0; n--) {
+        pf_putc(ch, c);
+    }
+}
+
+// Append the first `len` chars of `str`, padded up to `width`
+// Padding goes on the right if `left` is set, on the left otherwise
+static void pf_field(struct pf_chunk *ch, const char *str, int len,
+                     int width, int left) {
+    int i;
+
+    if (!left) {
+        pf_pad(ch, ' ', width - len);
+    }
+
+    for (i = 0; i < len; i++) {
+        pf_putc(ch, str[i]);
+    }
 
-// Send a printf-ed string to the port (blocking)
+    if (left) {
+        pf_pad(ch, ' ', width - len);
+    }
+}
+
+// Append `value` in the given `base` (10 or 16), padded up to `width`
+// If `zero` is set, pad with zeros after the sign instead of spaces
+static void pf_number(struct pf_chunk *ch, unsigned int value, int base,
+                      int neg, int width, int left, int zero) {
+    // 32 bits fit in 10 decimal digits, plus the sign
+    char digits[11];
+    int len = 0;
+
+    // A division by a runtime base would call __aeabi_uidivmod for
+    // each digit. Hex digits are a mask and a shift, and the division
+    // by the constant 10 is turned into a multiply by the compiler.
+    if (base == 16) {
+        do {
+            digits[len++] = "0123456789abcdef"[value & 0xF];
+            value >>= 4;
+        } while (value != 0);
+    } else {
+        do {
+            digits[len++] = '0' + value % 10;
+            value /= 10;
+        } while (value != 0);
+    }
+
+    if (neg) {
+        digits[len++] = '-';
+    }
+
+    if (zero && !left) {
+        if (neg) {
+            pf_putc(ch, digits[--len]);
+            width--;
+        }
+        pf_pad(ch, '0', width - len);
+    } else if (!left) {
+        pf_pad(ch, ' ', width - len);
+    }
+
+    width -= len;
+    while (len > 0) {
+        pf_putc(ch, digits[--len]);
+    }
+
+    if (left) {
+        pf_pad(ch, ' ', width);
+    }
+}
+
+// Send a printf-ed string to the port
+// Only a subset of printf is supported: %d %u %x %s %c %p and %%,
+// with an optional width, and the '-' (left justify) and '0' flags.
+// The output is formatted straight into small chunks, sent as soon as
+// they fill up, so no intermediate string buffer is needed.
 void uart_printf(enum UART port, char *fmt, ...) {
     va_list ap;
-    char str[256];
+    int width, left, zero;
+    int value;
+    char c;
+    char *str;
+    struct pf_chunk ch;
+
+    ch.port = port;
+    ch.len = 0;
 
     va_start(ap, fmt);
-    vsnprintf(str, 256, fmt, ap);
-    uart_send_str(port, str);
+    for (; *fmt != '\0'; fmt++) {
+        if (*fmt != '%') {
+            pf_putc(&ch, *fmt);
+            continue;
+        }
+
+        // Flags
+        left = 0;
+        zero = 0;
+        for (fmt++; *fmt == '-' || *fmt == '0'; fmt++) {
+            if (*fmt == '-') {
+                left = 1;
+            } else {
+                zero = 1;
+            }
+        }
+
+        // Width
+        for (width = 0; *fmt >= '0' && *fmt <= '9'; fmt++) {
+            width = width * 10 + (*fmt - '0');
+        }
+
+        switch (*fmt) {
+            case 'd':
+                value = va_arg(ap, int);
+                if (value < 0) {
+                    pf_number(&ch, -(unsigned int) value, 10, 1, width, left, zero);
+                } else {
+                    pf_number(&ch, value, 10, 0, width, left, zero);
+                }
+                break;
+            case 'u':
+                pf_number(&ch, va_arg(ap, unsigned int), 10, 0, width, left, zero);
+                break;
+            case 'x':
+                pf_number(&ch, va_arg(ap, unsigned int), 16, 0, width, left, zero);
+                break;
+            case 'p':
+                pf_putc(&ch, '0');
+                pf_putc(&ch, 'x');
+                pf_number(&ch, (unsigned int) va_arg(ap, void *), 16, 0, 8, 0, 1);
+                break;
+            case 's':
+                str = va_arg(ap, char *);
+                for (value = 0; str[value] != '\0'; value++);
+                pf_field(&ch, str, value, width, left);
+                break;
+            case 'c':
+                c = (char) va_arg(ap, int);
+                pf_field(&ch, &c, 1, width, left);
+                break;
+            case '%':
+                pf_putc(&ch, '%');
+                break;
+            case '\0':
+                // Stray % at the end of the format string
+                fmt--;
+                break;
+            default:
+                // Unknown conversion, print it as is
+                pf_putc(&ch, '%');
+                pf_putc(&ch, *fmt);
+                break;
+        }
+    }
     va_end(ap);
+
+    pf_flush(&ch);
 }
@@ -1,6 +1,18 @@
 #ifndef UART_H_
 #define UART_H_
 
+#include "44b.h"
+
+// Max baud rate error accepted by uart_lconf,
+// in hundredths of a percent (250 -> 2.50%)
+#ifndef UART_BAUD_TOL
+#define UART_BAUD_TOL 250
+#endif
+
+// UBRDIVn value for the given baud rate, rounded to the closest divisor
+// Integer-only, folds to a constant if `baud` is a constant
+#define UART_BRDIV(baud) (((MCLK) + 8 * (baud)) / (16 * (baud)) - 1)
+
 enum UART {
     UART0 = 0,
     UART1 = 1
@@ -32,6 +44,22 @@ enum UWORDLEN {
     EIGHT = 3
 };
 
+// Rx FIFO trigger level (bytes in the FIFO that raise an interrupt)
+enum URxTrig {
+    RXTRIG4 = 0,
+    RXTRIG8 = 1,
+    RXTRIG12 = 2,
+    RXTRIG16 = 3
+};
+
+// Tx FIFO trigger level (bytes left in the FIFO that raise an interrupt)
+enum UTxTrig {
+    TXTRIG0 = 0,
+    TXTRIG4 = 1,
+    TXTRIG8 = 2,
+    TXTRIG12 = 3
+};
+
 enum URxTxMode {
     DIS = 0,
     POLL = 1,
@@ -49,15 +77,78 @@ struct ulconf {
     enum UWORDLEN wordlen;
     enum ONOFF echo;
     int baud;
+    // Enable the 16-byte Rx/Tx FIFOs
+    enum ONOFF fifo;
+    // FIFO trigger levels (only used if fifo == ON)
+    enum URxTrig rxtrig;
+    enum UTxTrig txtrig;
+    // Hardware (nRTS/nCTS) auto flow control, needs fifo == ON
+    enum ONOFF afc;
+    // Canonical (line) mode, see uart_readline
+    enum ONOFF canon;
+    // Discard received bytes with parity or frame errors
+    enum ONOFF errdrop;
 };
 
+// Result of a baud rate divisor calculation
+struct ubaud {
+    // UBRDIVn value
+    int div;
+    // Baud rate actually obtained with `div`
+    int actual;
+    // Error of `actual` against the requested rate,
+    // in hundredths of a percent (signed)
+    int error;
+};
+
+// Receive statistics of a port
+struct ustats {
+    // Bytes dropped because the rx ring was full
+    unsigned int overflows;
+    // Max number of bytes ever waiting on the rx ring
+    unsigned int hwm;
+    // Line errors reported by the port
+    unsigned int overrun;
+    unsigned int parity;
+    unsigned int frame;
+    unsigned int brk;
+    // Bytes discarded because of a parity or frame error
+    unsigned int errdrops;
+};
+
+// Cost of an ISR, only kept when built with UART_BENCH
+struct uisrstats {
+    unsigned int calls;
+    // Bytes moved by the ISR
+    unsigned int bytes;
+    // Clock ticks spent inside the ISR, total and worst call
+    unsigned int ticks;
+    unsigned int worst;
+};
+
+static inline int uart_brdiv(int baud) {
+    return UART_BRDIV(baud);
+}
+
 void uart_init(void);
+int uart_baud(int baud, struct ubaud *res);
 int uart_lconf(enum UART port, struct ulconf *lconf);
 int uart_conf_txmode(enum UART port, enum URxTxMode mode);
 int uart_conf_rxmode(enum UART port, enum URxTxMode mode);
 int uart_getch(enum UART port, char *c);
+int uart_getbuf(enum UART port, char *buf, int size);
 int uart_sendch(enum UART port, char c);
 int uart_send_str(enum UART port, char *str);
+int uart_write_async(enum UART port, const char *buf, int len);
+int uart_flush(enum UART port);
+int uart_stats(enum UART port, struct ustats *st);
+int uart_line_ready(enum UART port);
+int uart_readline(enum UART port, char *buf, int size);
 void uart_printf(enum UART port, char *fmt, ...);
+int uart_loopback(enum UART port, enum ONOFF mode);
+#ifdef UART_BENCH
+int uart_isrstats(enum UART port, struct uisrstats *rx,
+                  struct uisrstats *tx, enum ONOFF reset);
+#endif
 
 #endif
@@ -0,0 +1,255 @@
+#include <string.h>
+#include "uart.h"
+#include "uframe.h"
+
+// Frame delimiter, COBS guarantees it never shows up inside a frame
+#define DELIM 0x00
+
+// Longest run of non-zero bytes a COBS block can hold
+#define COBS_BLOCK 254
+
+// CRC-16/CCITT (poly 0x1021, init 0xFFFF) lookup table
+static const unsigned short crc_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0,
+};
+
+// COBS block being encoded by uframe_send
+struct cobs_enc {
+    enum UART port;
+    // Code byte, followed by up to COBS_BLOCK non-zero bytes
+    unsigned char block[COBS_BLOCK + 1];
+    // Bytes in block (including the code byte)
+    int len;
+};
+
+// Compute the CRC-16/CCITT of `data`, one table lookup per byte
+unsigned short uframe_crc(const unsigned char *data, int len) {
+    unsigned short crc = 0xFFFF;
+
+    while (len-- > 0) {
+        crc = (crc << 8) ^ crc_table[((crc >> 8) ^ *data++) & 0xFF];
+    }
+
+    return crc;
+}
+
+// Send the block being encoded, its code byte is its length
+static void cobs_flush(struct cobs_enc *enc) {
+    enc->block[0] = enc->len;
+    uart_write_async(enc->port, (const char *) enc->block, enc->len);
+    enc->len = 1;
+}
+
+// Encode `c` into the current block
+// A zero ends the block (the decoder puts it back), as does
+// a block full of non-zero bytes (with no zero implied).
+static void cobs_put(struct cobs_enc *enc, unsigned char c) {
+    if (c == 0) {
+        cobs_flush(enc);
+        return;
+    }
+
+    enc->block[enc->len++] = c;
+    if (enc->len == COBS_BLOCK + 1) {
+        cobs_flush(enc);
+    }
+}
+
+// Decode the COBS frame in `buf` in place (decoded data is never longer)
+// Returns the decoded length, -1 if the frame is malformed
+static int cobs_decode(unsigned char *buf, int len) {
+    int i;
+    int code;
+    int in = 0;
+    int out = 0;
+
+    while (in < len) {
+        code = buf[in++];
+        if (code == 0 || in + code - 1 > len) {
+            return -1;
+        }
+
+        for (i = 1; i < code; i++) {
+            buf[out++] = buf[in++];
+        }
+
+        // Every block but full ones (and the last one) ends in a zero
+        if (code != COBS_BLOCK + 1 && in < len) {
+            buf[out++] = 0;
+        }
+    }
+
+    return out;
+}
+
+// Set up `rx` to receive frames from `port` into `buf`
+void uframe_rx_init(struct uframe_rx *rx, enum UART port,
+                    unsigned char *buf, int size) {
+    rx->port = port;
+    rx->buf = buf;
+    rx->size = size;
+    rx->start = 0;
+    rx->len = 0;
+    rx->scanned = 0;
+    rx->consumed = 0;
+    rx->skip = 0;
+    rx->toolong = 0;
+    rx->errors = 0;
+}
+
+// Send `len` bytes of `data` as a single frame
+// The frame is encoded on the fly, one COBS block at a time,
+// and the CRC is appended (big-endian) after the payload.
+// Empty frames aren't allowed, uframe_recv returns 0 for "no frame".
+int uframe_send(enum UART port, const unsigned char *data, int len) {
+    int i;
+    unsigned short crc;
+    struct cobs_enc enc;
+    unsigned char delim = DELIM;
+
+    if (len <= 0) {
+        return -1;
+    }
+
+    crc = uframe_crc(data, len);
+    enc.port = port;
+    enc.len = 1;
+
+    // Leading delimiter, so the receiver drops any noise before the frame
+    uart_write_async(port, (const char *) &delim, 1);
+
+    for (i = 0; i < len; i++) {
+        cobs_put(&enc, data[i]);
+    }
+    cobs_put(&enc, crc >> 8);
+    cobs_put(&enc, crc & 0xFF);
+    cobs_flush(&enc);
+
+    uart_write_async(port, (const char *) &delim, 1);
+
+    return len;
+}
+
+// Drop the consumed bytes, by moving the start of the receive buffer
+// past them. Once everything is consumed, start over from the front.
+static void uframe_drop(struct uframe_rx *rx) {
+    rx->start += rx->consumed;
+    rx->scanned = rx->start;
+    rx->consumed = 0;
+
+    if (rx->start == rx->len) {
+        rx->start = 0;
+        rx->len = 0;
+        rx->scanned = 0;
+    }
+}
+
+// Move the bytes not consumed yet to the front of the receive buffer
+// Only needed when the buffer fills up in the middle of a frame.
+static void uframe_compact(struct uframe_rx *rx) {
+    if (rx->start > 0) {
+        memmove(rx->buf, rx->buf + rx->start, rx->len - rx->start);
+        rx->len -= rx->start;
+        rx->scanned -= rx->start;
+        rx->start = 0;
+    }
+}
+
+// Poll for a complete frame, without blocking
+// If there's one, point `frame` to its payload and return its length.
+// The payload is decoded in place in the receive buffer, and stays
+// valid until the next call. Returns 0 if there's no frame yet.
+//
+// Corrupted frames (bad encoding or CRC, or an empty payload), and
+// frames too long for the receive buffer, are counted and dropped.
+int uframe_recv(struct uframe_rx *rx, unsigned char **frame) {
+    int end;
+    int len;
+    unsigned char *data;
+    unsigned short crc;
+
+    // Drop the frame handed out on the previous call
+    uframe_drop(rx);
+
+    // Make room for more bytes, only if the buffer filled up
+    if (rx->len == rx->size) {
+        uframe_compact(rx);
+    }
+
+    len = uart_getbuf(rx->port, (char *) rx->buf + rx->len, rx->size - rx->len);
+    if (len > 0) {
+        rx->len += len;
+    }
+
+    while (1) {
+        for (end = rx->scanned; end < rx->len && rx->buf[end] != DELIM; end++);
+
+        if (end == rx->len) {
+            // No delimiter in a full buffer, the frame can't fit.
+            // Drop what we have, and everything up to the next delimiter
+            if (rx->len - rx->start == rx->size) {
+                rx->toolong++;
+                rx->skip = 1;
+                rx->len = 0;
+                end = 0;
+            }
+
+            rx->scanned = end;
+            return 0;
+        }
+
+        // Skip the frame [start, end) and its delimiter
+        rx->consumed = end + 1 - rx->start;
+
+        // Empty frame (leading delimiter), or tail of a frame too long
+        if (end == rx->start || rx->skip == 1) {
+            rx->skip = 0;
+        } else {
+            // Decode in place, then check (and strip) the CRC
+            data = rx->buf + rx->start;
+            len = cobs_decode(data, end - rx->start);
+            if (len > 2) {
+                crc = (data[len - 2] << 8) | data[len - 1];
+                if (uframe_crc(data, len - 2) == crc) {
+                    *frame = data;
+                    return len - 2;
+                }
+            }
+
+            rx->errors++;
+        }
+
+        uframe_drop(rx);
+    }
+}
@@ -0,0 +1,41 @@
+// Framed binary transport over UART
+//
+// Frames are COBS-encoded (so they never contain a 0x00 byte), followed
+// by a CRC-16/CCITT of the payload, and delimited by 0x00 bytes.
+// The port should be set up with echo and canonical mode OFF.
+
+#ifndef UFRAME_H_
+#define UFRAME_H_
+
+#include "uart.h"
+
+// Max payload that fits in a receive buffer of `size` bytes
+// (COBS overhead, CRC and delimiter)
+#define UFRAME_MAXLEN(size) ((size) - ((size) / 254) - 4)
+
+struct uframe_rx {
+    enum UART port;
+    // Receive buffer, frames are decoded in place
+    unsigned char *buf;
+    int size;
+    // Bytes received into buf, the ones before `start` are done with
+    int start;
+    int len;
+    // Bytes of buf already searched for a delimiter
+    int scanned;
+    // Bytes after `start` taken by the frame handed out on the last call
+    int consumed;
+    // Set while dropping the tail of a frame larger than buf
+    int skip;
+    // Frames dropped because they were too long, or corrupted
+    unsigned int toolong;
+    unsigned int errors;
+};
+
+void uframe_rx_init(struct uframe_rx *rx, enum UART port,
+                    unsigned char *buf, int size);
+int uframe_send(enum UART port, const unsigned char *data, int len);
+int uframe_recv(struct uframe_rx *rx, unsigned char **frame);
+unsigned short uframe_crc(const unsigned char *data, int len);
+
+#endif
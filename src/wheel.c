@@ -0,0 +1,258 @@
+#include <stddef.h>
+#include "44b.h"
+#include "intcontroller.h"
+#include "timer.h"
+#include "wheel.h"
+
+// 4 levels of 64 slots. Level n slots are 64^n ticks wide, so
+// the wheel covers 64^4 ticks (~4.6 hours at 1ms) with 256 lists.
+// Timers on the upper levels are moved down (cascaded) a level
+// every time the level below wraps around.
+#define LVL_BITS 6
+#define LVL_SIZE (1 << LVL_BITS)
+#define LVL_MASK (LVL_SIZE - 1)
+#define LEVELS 4
+
+// Max ticks ahead a timer can be set to
+#define WHEEL_MAX ((1u << (LEVELS * LVL_BITS)) - 1)
+
+// TIMER2 runs at MCLK / (63 + 1) / 2 = 500 kHz
+// The period is WHEEL_COUNT + 1 ticks (see timer.h)
+#define WHEEL_PRESCALER 63
+#define WHEEL_COUNT (((MCLK) / (WHEEL_PRESCALER + 1) / 2) / (1000000 / WHEEL_TICK_US) - 1)
+
+static struct wheel_node slots[LEVELS][LVL_SIZE];
+// Ticks since wheel_init
+static volatile unsigned int now;
+// Set while the ISR runs, timers are being fired
+static int in_tick;
+
+void Wheel_TimerInt(void) __attribute__ ((interrupt ("IRQ")));
+
+static void list_init(struct wheel_node *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_add(struct wheel_node *head, struct wheel_node *node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static void list_del(struct wheel_node *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+// Link the timer on the slot matching its expiry time
+static void wheel_link(struct wheel_timer *t) {
+    unsigned int expires = t->expires;
+    unsigned int delta = expires - now;
+    int level;
+
+    // In the past, fire it on the next tick
+    // (delta 0 only comes from a cascade, right before the current
+    // level 0 slot is run)
+    if (delta > (~0u >> 1)) {
+        expires = now + 1;
+        delta = 1;
+    } else if (delta > WHEEL_MAX) {
+        expires = now + WHEEL_MAX;
+        delta = WHEEL_MAX;
+    }
+
+    for (level = 0; level < LEVELS - 1; level++) {
+        if (delta < (1u << ((level + 1) * LVL_BITS))) {
+            break;
+        }
+    }
+
+    t->expires = expires;
+    list_add(&slots[level][(expires >> (level * LVL_BITS)) & LVL_MASK], &t->node);
+}
+
+// Move every timer on the given slot to the level below
+static void wheel_cascade(int level, int slot) {
+    struct wheel_node list;
+    struct wheel_node *head = &slots[level][slot];
+
+    if (head->next == head) {
+        return;
+    }
+
+    // Detach the whole list first, timers may go back to the same level
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    list_init(head);
+
+    while (list.next != &list) {
+        struct wheel_node *node = list.next;
+        list_del(node);
+        wheel_link((struct wheel_timer *) node);
+    }
+}
+
+// TIMER2 ISR, advance the wheel one tick and fire the due timers
+void Wheel_TimerInt(void) {
+    int level;
+    struct wheel_node *head;
+    struct wheel_timer *t;
+
+    in_tick = 1;
+    now++;
+
+    // Level 0 wrapped, bring the next batch down from level 1
+    // (and from level 2 if level 1 wrapped too, and so on)
+    for (level = 1; level < LEVELS; level++) {
+        unsigned int shift = level * LVL_BITS;
+
+        if ((now & ((1u << shift) - 1)) != 0) {
+            break;
+        }
+    }
+    while (--level > 0) {
+        wheel_cascade(level, (now >> (level * LVL_BITS)) & LVL_MASK);
+    }
+
+    // Every timer on the current level 0 slot is due
+    head = &slots[0][now & LVL_MASK];
+    while (head->next != head) {
+        t = (struct wheel_timer *) head->next;
+        list_del(&t->node);
+
+        if (t->period != 0) {
+            t->expires += t->period;
+            wheel_link(t);
+        }
+
+        t->fn(t->arg);
+    }
+
+    in_tick = 0;
+    ic_cleanflag(INT_TIMER2);
+}
+
+// Keep the TIMER2 ISR away while the slots are changed from
+// the main loop. Callbacks already run with it masked.
+static int wheel_lock(void) {
+    if (in_tick) {
+        return 0;
+    }
+
+    ic_disable(INT_TIMER2);
+    return 1;
+}
+
+static void wheel_unlock(int locked) {
+    if (locked) {
+        ic_enable(INT_TIMER2);
+    }
+}
+
+// Empty the wheel and start ticking it from TIMER2
+// TIMER3 shares the prescaler, which is set to WHEEL_PRESCALER
+// Should be called after ic_init
+int wheel_init(void) {
+    int level;
+    int slot;
+    struct tmr_txn tx;
+
+    for (level = 0; level < LEVELS; level++) {
+        for (slot = 0; slot < LVL_SIZE; slot++) {
+            list_init(&slots[level][slot]);
+        }
+    }
+
+    now = 0;
+    in_tick = 0;
+
+    tmr_stop(TIMER2);
+
+    tmr_txn_begin(&tx);
+    if (tmr_txn_prescaler(&tx, 1, WHEEL_PRESCALER) != 0 ||
+        tmr_txn_divider(&tx, 2, D1_2) != 0 ||
+        tmr_txn_count(&tx, TIMER2, WHEEL_COUNT, 0) != 0 ||
+        tmr_txn_mode(&tx, TIMER2, RELOAD) != 0 ||
+        tmr_txn_start(&tx, TIMER2) != 0) {
+        return -1;
+    }
+
+    pISR_TIMER2 = (int) Wheel_TimerInt;
+    ic_conf_line(INT_TIMER2, IRQ);
+    ic_enable(INT_TIMER2);
+
+    tmr_txn_commit(&tx);
+    return 0;
+}
+
+// Set up a timer calling fn(arg), not yet on the wheel
+void wheel_timer_init(struct wheel_timer *t, wheel_fn fn, void *arg) {
+    t->node.next = NULL;
+    t->node.prev = NULL;
+    t->expires = 0;
+    t->period = 0;
+    t->fn = fn;
+    t->arg = arg;
+}
+
+// Fire the timer `ticks` ticks from now, and then every `period`
+// ticks (0 for a one-shot timer). A pending timer is re-armed.
+// Can be called from a timer callback.
+int wheel_add(struct wheel_timer *t, unsigned int ticks, unsigned int period) {
+    int locked;
+
+    if (t->fn == NULL || ticks > WHEEL_MAX || period > WHEEL_MAX) {
+        return -1;
+    }
+
+    locked = wheel_lock();
+
+    if (t->node.next != NULL) {
+        list_del(&t->node);
+    }
+
+    // The current slot may already be done, the earliest is the next tick
+    if (ticks == 0) {
+        ticks = 1;
+    }
+
+    t->expires = now + ticks;
+    t->period = period;
+    wheel_link(t);
+
+    wheel_unlock(locked);
+    return 0;
+}
+
+// Take the timer off the wheel
+// Returns 1 if it was pending, 0 if not
+int wheel_cancel(struct wheel_timer *t) {
+    int locked;
+    int pending = 0;
+
+    locked = wheel_lock();
+
+    if (t->node.next != NULL) {
+        list_del(&t->node);
+        pending = 1;
+    }
+
+    wheel_unlock(locked);
+    return pending;
+}
+
+// 1 if the timer is on the wheel, 0 if not
+int wheel_pending(struct wheel_timer *t) {
+    return (t->node.next != NULL);
+}
+
+// Ticks since wheel_init, wraps around every ~49 days
+unsigned int wheel_now(void) {
+    return now;
+}
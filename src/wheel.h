@@ -0,0 +1,44 @@
+// Software timers on a hierarchical timer wheel
+//
+// Any number of one-shot and periodic timers share TIMER2, which
+// ticks the wheel every WHEEL_TICK_US microseconds. Timers are
+// caller-owned and linked into the wheel in place, so adding and
+// cancelling a timer is O(1) and never allocates.
+// Callbacks run from the TIMER2 ISR, and should be short.
+
+#ifndef WHEEL_H_
+#define WHEEL_H_
+
+// Wheel tick period (1ms)
+#define WHEEL_TICK_US 1000
+
+// Ticks for the given milliseconds
+#define WHEEL_MS(ms) ((ms) * (1000 / WHEEL_TICK_US))
+
+typedef void (*wheel_fn)(void *arg);
+
+// Intrusive list node
+struct wheel_node {
+    struct wheel_node *next;
+    struct wheel_node *prev;
+};
+
+struct wheel_timer {
+    // Must be the first member, the wheel slots link these nodes
+    struct wheel_node node;
+    // Tick on which the timer fires
+    unsigned int expires;
+    // Reload period, in ticks (0 -> one-shot)
+    unsigned int period;
+    wheel_fn fn;
+    void *arg;
+};
+
+int wheel_init(void);
+void wheel_timer_init(struct wheel_timer *t, wheel_fn fn, void *arg);
+int wheel_add(struct wheel_timer *t, unsigned int ticks, unsigned int period);
+int wheel_cancel(struct wheel_timer *t);
+int wheel_pending(struct wheel_timer *t);
+unsigned int wheel_now(void);
+
+#endif
@@ -0,0 +1,119 @@
+// ns/op of ring_t, single element and bulk paths, across capacities
+//
+// For reference, the same loops run on the previous ring_t
+// implementation (indices wrapped with %, separate full flag),
+// kept here as `modring`.
+
+#include <stdio.h>
+#include <time.h>
+#include "ring.h"
+
+#define OPS (1 << 24)
+#define BULK 32
+
+// Previous implementation, for before/after numbers
+struct modring {
+    char *buffer;
+    unsigned int start;
+    unsigned int end;
+    unsigned int capacity;
+    unsigned int full;
+};
+
+static void modring_put(struct modring *r, char data) {
+    r->buffer[r->start] = data;
+    if (r->full) {
+        r->end = (r->end + 1) % r->capacity;
+    }
+    r->start = (r->start + 1) % r->capacity;
+    r->full = (r->start == r->end);
+}
+
+static int modring_get(struct modring *r, char *data) {
+    if (!r->full && r->start == r->end) {
+        return -1;
+    }
+    *data = r->buffer[r->end];
+    r->full = 0;
+    r->end = (r->end + 1) % r->capacity;
+    return 0;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Keep the compiler from dropping the loops
+static volatile char sink;
+
+static double bench_single(unsigned int cap) {
+    static char buf[4096];
+    struct ring_t r;
+    unsigned int i;
+    char c = 0;
+    double t;
+
+    ring_init(&r, buf, cap);
+    t = now_ns();
+    for (i = 0; i < OPS; i++) {
+        ring_put(&r, (char) i);
+        ring_get(&r, &c);
+        sink = c;
+    }
+    return (now_ns() - t) / OPS;
+}
+
+static double bench_mod(unsigned int cap) {
+    static char buf[4096];
+    struct modring r = {buf, 0, 0, 0, 0};
+    unsigned int i;
+    char c = 0;
+    double t;
+
+    // Odd capacity, so the compiler can't turn % into a mask
+    r.capacity = cap - 1;
+    t = now_ns();
+    for (i = 0; i < OPS; i++) {
+        modring_put(&r, (char) i);
+        modring_get(&r, &c);
+        sink = c;
+    }
+    return (now_ns() - t) / OPS;
+}
+
+static double bench_bulk(unsigned int cap) {
+    static char buf[4096];
+    char in[BULK];
+    char out[BULK];
+    struct ring_t r;
+    unsigned int i;
+    double t;
+
+    for (i = 0; i < BULK; i++) {
+        in[i] = i;
+    }
+
+    ring_init(&r, buf, cap);
+    t = now_ns();
+    for (i = 0; i < OPS / BULK; i++) {
+        ring_put_n(&r, in, BULK);
+        ring_get_n(&r, out, BULK);
+        sink = out[i % BULK];
+    }
+    return (now_ns() - t) / OPS;
+}
+
+int main(void) {
+    unsigned int cap;
+
+    printf("%8s %14s %14s %14s\n", "capacity", "% put+get", "put+get", "bulk (/byte)");
+    for (cap = 64; cap <= 4096; cap <<= 2) {
+        printf("%8u %11.2f ns %11.2f ns %11.2f ns\n",
+               cap, bench_mod(cap), bench_single(cap), bench_bulk(cap));
+    }
+
+    return 0;
+}
@@ -0,0 +1,342 @@
+// Exhaustive producer/consumer interleavings of the SPSC ring API
+//
+// The producer and the consumer run as coroutines. ring.c is built
+// with RING_BARRIER() switching between them (see ring_spsc.h), and
+// both also yield between operations, so an "ISR" can run at any
+// barrier of the other side, just like on the board. Every possible
+// schedule of those switch points is explored (stateless model
+// checking: replay a prefix of choices, then branch on the last one).
+//
+// The producer pushes consecutive sequence numbers. The consumer must
+// see them in order, none missing or repeated, and at the end the ring
+// must hold exactly the ones it didn't take.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#include "ring.h"
+#include "ringt.h"
+
+// Max switch points in a single schedule
+#define MAXDEPTH 256
+#define STACK_SIZE (64 * 1024)
+
+// Ring capacity of every scenario
+#define CAP 2
+
+RING_DECLARE(u32_ring, unsigned int)
+
+enum side { PRODUCER = 0, CONSUMER = 1 };
+
+struct scenario {
+    const char *name;
+    void (*prod)(void);
+    void (*cons)(void);
+    int typed;
+    // Operations on each side
+    int ops;
+};
+
+static struct scenario *current;
+
+static ucontext_t sched_ctx;
+static ucontext_t side_ctx[2];
+static char stacks[2][STACK_SIZE];
+static int done[2];
+static enum side running;
+
+// Choices made at each switch point: 0 keep running, 1 switch
+static int choice[MAXDEPTH];
+static int depth;
+static int replay;
+
+// Scenario state
+static struct ring_t ring;
+static char buf[CAP];
+static struct u32_ring ring32;
+static unsigned int buf32[CAP];
+static unsigned int produced;
+static unsigned int consumed;
+static int failed;
+static const char *failure;
+
+void spsc_yield(void) {
+    int c;
+
+    // Nothing to interleave with
+    if (done[!running]) {
+        return;
+    }
+
+    if (depth >= MAXDEPTH) {
+        failure = "schedule too deep";
+        failed = 1;
+        return;
+    }
+
+    if (depth < replay) {
+        c = choice[depth];
+    } else {
+        c = 0;
+        choice[depth] = 0;
+    }
+    depth++;
+
+    if (c == 1) {
+        enum side me = running;
+        running = !me;
+        swapcontext(&side_ctx[me], &side_ctx[!me]);
+    }
+}
+
+static void check(int cond, const char *what) {
+    if (!cond && !failed) {
+        failed = 1;
+        failure = what;
+    }
+}
+
+static void consumed_value(unsigned int v) {
+    check(v == consumed + 1, "out of order, lost or repeated value");
+    consumed = v;
+}
+
+// Producer and consumer bodies of each scenario
+
+static void prod_push(void) {
+    int i;
+
+    for (i = 0; i < current->ops; i++) {
+        spsc_yield();
+        if (ring_push(&ring, (char) (produced + 1)) == 0) {
+            produced++;
+        }
+    }
+}
+
+static void cons_get(void) {
+    int i;
+    char c;
+
+    for (i = 0; i < current->ops; i++) {
+        spsc_yield();
+        if (ring_get(&ring, &c) == 0) {
+            consumed_value((unsigned char) c);
+        }
+    }
+}
+
+static void cons_get_n(void) {
+    int i;
+    unsigned int j;
+    unsigned int n;
+    char out[CAP];
+
+    for (i = 0; i < current->ops; i++) {
+        spsc_yield();
+        n = ring_get_n(&ring, out, CAP);
+        for (j = 0; j < n; j++) {
+            consumed_value((unsigned char) out[j]);
+        }
+    }
+}
+
+static void prod_reserve(void) {
+    int i;
+    unsigned int j;
+    unsigned int n;
+    char *p;
+
+    for (i = 0; i < current->ops; i++) {
+        spsc_yield();
+        n = ring_reserve(&ring, &p, CAP);
+        for (j = 0; j < n; j++) {
+            p[j] = (char) (produced + 1 + j);
+        }
+        spsc_yield();
+        ring_commit(&ring, n);
+        produced += n;
+    }
+}
+
+static void cons_peek(void) {
+    int i;
+    unsigned int j;
+    unsigned int n;
+    char *p;
+
+    for (i = 0; i < current->ops; i++) {
+        spsc_yield();
+        n = ring_peek(&ring, &p);
+        for (j = 0; j < n; j++) {
+            consumed_value((unsigned char) p[j]);
+        }
+        spsc_yield();
+        check(ring_consume(&ring, n) == n, "consume took less than peeked");
+    }
+}
+
+static void prod_push32(void) {
+    int i;
+
+    for (i = 0; i < current->ops; i++) {
+        spsc_yield();
+        if (u32_ring_push(&ring32, produced + 1) == 0) {
+            produced++;
+        }
+    }
+}
+
+static void cons_get32(void) {
+    int i;
+    unsigned int v;
+
+    for (i = 0; i < current->ops; i++) {
+        spsc_yield();
+        if (u32_ring_get(&ring32, &v) == 0) {
+            consumed_value(v);
+        }
+    }
+}
+
+static void prod_reserve32(void) {
+    int i;
+    unsigned int j;
+    unsigned int n;
+    unsigned int *p;
+
+    for (i = 0; i < current->ops; i++) {
+        spsc_yield();
+        n = u32_ring_reserve(&ring32, &p, CAP);
+        for (j = 0; j < n; j++) {
+            p[j] = produced + 1 + j;
+        }
+        spsc_yield();
+        u32_ring_commit(&ring32, n);
+        produced += n;
+    }
+}
+
+static void cons_peek32(void) {
+    int i;
+    unsigned int j;
+    unsigned int n;
+    unsigned int *p;
+
+    for (i = 0; i < current->ops; i++) {
+        spsc_yield();
+        n = u32_ring_peek(&ring32, &p);
+        for (j = 0; j < n; j++) {
+            consumed_value(p[j]);
+        }
+        spsc_yield();
+        check(u32_ring_consume(&ring32, n) == n, "consume took less than peeked");
+    }
+}
+
+// Operations per side are kept small: the number of schedules
+// grows exponentially with them
+static struct scenario scenarios[] = {
+    {"push / get", prod_push, cons_get, 0, 3},
+    {"push / get_n", prod_push, cons_get_n, 0, 3},
+    {"reserve+commit / peek+consume", prod_reserve, cons_peek, 0, 2},
+    {"reserve+commit / get", prod_reserve, cons_get, 0, 3},
+    {"push / peek+consume", prod_push, cons_peek, 0, 3},
+    {"typed push / get", prod_push32, cons_get32, 1, 3},
+    {"typed reserve+commit / peek+consume", prod_reserve32, cons_peek32, 1, 2},
+};
+
+static void run_side(int s) {
+    if (s == PRODUCER) {
+        current->prod();
+    } else {
+        current->cons();
+    }
+    done[s] = 1;
+    running = !s;
+    // Let the other side finish (or return to the scheduler)
+    if (!done[!s]) {
+        setcontext(&side_ctx[!s]);
+    }
+}
+
+// Run one schedule, replaying the first `replay` choices
+static void run_once(void) {
+    int s;
+
+    ring_init(&ring, buf, CAP);
+    u32_ring_init(&ring32, buf32, CAP);
+    // Start right below the index wraparound
+    ring.start = ring.end = 0xFFFFFFFFu;
+    ring32.start = ring32.end = 0xFFFFFFFFu;
+    produced = 0;
+    consumed = 0;
+    depth = 0;
+    done[PRODUCER] = 0;
+    done[CONSUMER] = 0;
+
+    for (s = 0; s < 2; s++) {
+        getcontext(&side_ctx[s]);
+        side_ctx[s].uc_stack.ss_sp = stacks[s];
+        side_ctx[s].uc_stack.ss_size = STACK_SIZE;
+        side_ctx[s].uc_link = &sched_ctx;
+        makecontext(&side_ctx[s], (void (*)(void)) run_side, 1, s);
+    }
+
+    running = PRODUCER;
+    swapcontext(&sched_ctx, &side_ctx[PRODUCER]);
+
+    // Whatever wasn't consumed must still be in the ring
+    if (current->typed) {
+        check(u32_ring_size(&ring32) == produced - consumed, "size mismatch at the end");
+    } else {
+        check(ring_size(&ring) == produced - consumed, "size mismatch at the end");
+    }
+}
+
+// Explore every schedule of the current scenario
+// Returns the number of schedules, or -1 on failure
+static long explore(void) {
+    long runs = 0;
+
+    replay = 0;
+    failed = 0;
+
+    while (1) {
+        run_once();
+        runs++;
+
+        if (failed) {
+            return -1;
+        }
+
+        // Backtrack: flip the last 0 choice to 1, drop the rest
+        while (depth > 0 && choice[depth - 1] == 1) {
+            depth--;
+        }
+        if (depth == 0) {
+            return runs;
+        }
+        choice[depth - 1] = 1;
+        replay = depth;
+    }
+}
+
+int main(void) {
+    unsigned int i;
+    long runs;
+    int failures = 0;
+
+    for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        current = &scenarios[i];
+        runs = explore();
+        if (runs < 0) {
+            printf("FAIL %s: %s\n", current->name, failure);
+            failures++;
+        } else {
+            printf("%-40s %8ld schedules ok\n", current->name, runs);
+        }
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,4 @@
+// Force-included in ring.c by the ring_spsc build: every barrier
+// is a point where the other side may run
+void spsc_yield(void);
+#define RING_BARRIER() spsc_yield()
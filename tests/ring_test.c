@@ -0,0 +1,364 @@
+// Randomized tests of ring_t, and of a typed ring (ringt.h) with
+// multi-byte elements, against a reference model
+//
+// The model is a plain array holding the ring contents in order,
+// oldest first, with the same overwrite-when-full semantics.
+// Every step applies a random operation to both and compares
+// the results and the full contents.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ring.h"
+#include "ringt.h"
+
+#define STEPS 200000
+#define MAXCAP 64
+
+struct model {
+    char data[MAXCAP];
+    unsigned int len;
+    unsigned int cap;
+};
+
+static int failures;
+
+#define CHECK(cond, ...)                                            \
+    do {                                                            \
+        if (!(cond)) {                                              \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);             \
+            printf(__VA_ARGS__);                                    \
+            printf("\n");                                           \
+            failures++;                                             \
+            return;                                                 \
+        }                                                           \
+    } while (0)
+
+static void model_put(struct model *m, char c) {
+    if (m->len == m->cap) {
+        memmove(m->data, m->data + 1, m->len - 1);
+        m->len--;
+    }
+    m->data[m->len++] = c;
+}
+
+static int model_get(struct model *m, char *c) {
+    if (m->len == 0) {
+        return -1;
+    }
+    *c = m->data[0];
+    memmove(m->data, m->data + 1, m->len - 1);
+    m->len--;
+    return 0;
+}
+
+// Compare the ring contents with the model, without consuming them
+static int same(struct ring_t *r, struct model *m) {
+    unsigned int i;
+
+    if (ring_size(r) != m->len) {
+        return 0;
+    }
+    for (i = 0; i < m->len; i++) {
+        if (r->buffer[(r->end + i) & r->mask] != m->data[i]) {
+            return 0;
+        }
+    }
+    return ring_empty(r) == (m->len == 0) && ring_full(r) == (m->len == m->cap);
+}
+
+static void test_init(void) {
+    char buf[8];
+    struct ring_t r;
+
+    CHECK(ring_init(&r, buf, 0) == -1, "size 0 accepted");
+    CHECK(ring_init(&r, buf, 6) == -1, "size 6 accepted");
+    CHECK(ring_init(&r, buf, 8) == 0, "size 8 refused");
+    CHECK(ring_capacity(&r) == 8, "capacity");
+    CHECK(ring_empty(&r) && ring_size(&r) == 0, "not empty after init");
+}
+
+// Random sequence of operations, starting with the indices right
+// before the 32-bit wraparound
+static void test_random(unsigned int cap, unsigned int seed) {
+    char buf[MAXCAP];
+    char in[2 * MAXCAP];
+    char out[2 * MAXCAP];
+    char a = 0, b = 0;
+    char *p;
+    struct ring_t r;
+    struct model m = {{0}, 0, cap};
+    unsigned int n, got, i, step;
+    int ra, rb;
+
+    srand(seed);
+    ring_init(&r, buf, cap);
+    r.start = r.end = 0xFFFFFFFFu - cap;
+
+    for (step = 0; step < STEPS; step++) {
+        switch (rand() % 10) {
+            case 0:
+            case 1:
+                a = rand();
+                ring_put(&r, a);
+                model_put(&m, a);
+                break;
+
+            case 2:
+                a = rand();
+                ra = ring_push(&r, a);
+                rb = (m.len == m.cap) ? -1 : 0;
+                if (rb == 0) {
+                    model_put(&m, a);
+                }
+                CHECK(ra == rb, "push %d, model %d (step %u)", ra, rb, step);
+                break;
+
+            case 3:
+            case 4:
+                ra = ring_get(&r, &a);
+                rb = model_get(&m, &b);
+                CHECK(ra == rb && (ra != 0 || a == b),
+                      "get %d/%d, model %d/%d (step %u)", ra, a, rb, b, step);
+                break;
+
+            case 5:
+                n = rand() % (2 * cap + 1);
+                for (i = 0; i < n; i++) {
+                    in[i] = rand();
+                    model_put(&m, in[i]);
+                }
+                ring_put_n(&r, in, n);
+                break;
+
+            case 6:
+                n = rand() % (2 * cap + 1);
+                got = ring_get_n(&r, out, n);
+                CHECK(got == (n < m.len ? n : m.len), "get_n %u of %u", got, n);
+                for (i = 0; i < got; i++) {
+                    model_get(&m, &b);
+                    CHECK(out[i] == b, "get_n byte %u (step %u)", i, step);
+                }
+                break;
+
+            case 7:
+                n = rand() % (cap + 1);
+                got = ring_reserve(&r, &p, n);
+                CHECK(got <= n && got <= cap - m.len, "reserve %u of %u", got, n);
+                CHECK(p >= buf && p + got <= buf + cap, "reserve out of bounds");
+                got = got ? rand() % (got + 1) : 0;
+                for (i = 0; i < got; i++) {
+                    p[i] = rand();
+                    model_put(&m, p[i]);
+                }
+                ring_commit(&r, got);
+                break;
+
+            case 8:
+                got = ring_peek(&r, &p);
+                CHECK(got <= m.len && (m.len == 0 || got > 0), "peek %u of %u", got, m.len);
+                CHECK(got == 0 || (p >= buf && p + got <= buf + cap), "peek out of bounds");
+                for (i = 0; i < got; i++) {
+                    CHECK(p[i] == m.data[i], "peek byte %u (step %u)", i, step);
+                }
+                n = rand() % (cap + 1);
+                got = ring_consume(&r, n);
+                CHECK(got == (n < m.len ? n : m.len), "consume %u of %u", got, n);
+                for (i = 0; i < got; i++) {
+                    model_get(&m, &b);
+                }
+                break;
+
+            case 9:
+                if (rand() % 50 == 0) {
+                    ring_reset(&r);
+                    m.len = 0;
+                }
+                break;
+        }
+
+        CHECK(same(&r, &m), "contents differ at step %u (cap %u)", step, cap);
+    }
+}
+
+// Elements of 8 bytes, so a copy that forgets sizeof(type) shows up
+struct rec {
+    unsigned int seq;
+    unsigned short tag;
+    char c;
+};
+
+RING_DECLARE(rec_ring, struct rec)
+
+struct rec_model {
+    struct rec data[MAXCAP];
+    unsigned int len;
+    unsigned int cap;
+};
+
+static void rec_model_put(struct rec_model *m, struct rec e) {
+    if (m->len == m->cap) {
+        memmove(m->data, m->data + 1, (m->len - 1) * sizeof(struct rec));
+        m->len--;
+    }
+    m->data[m->len++] = e;
+}
+
+static void rec_model_get(struct rec_model *m, struct rec *e) {
+    *e = m->data[0];
+    memmove(m->data, m->data + 1, (m->len - 1) * sizeof(struct rec));
+    m->len--;
+}
+
+static int rec_eq(struct rec a, struct rec b) {
+    return a.seq == b.seq && a.tag == b.tag && a.c == b.c;
+}
+
+// A new element, distinct from all the previous ones
+static struct rec rec_next(unsigned int *seq) {
+    struct rec e;
+
+    e.seq = (*seq)++;
+    e.tag = rand();
+    e.c = rand();
+    return e;
+}
+
+static int rec_same(struct rec_ring *r, struct rec_model *m) {
+    unsigned int i;
+
+    if (rec_ring_size(r) != m->len) {
+        return 0;
+    }
+    for (i = 0; i < m->len; i++) {
+        if (!rec_eq(r->buffer[(r->end + i) & r->mask], m->data[i])) {
+            return 0;
+        }
+    }
+    return rec_ring_empty(r) == (m->len == 0) && rec_ring_full(r) == (m->len == m->cap);
+}
+
+// Same as test_random, on the typed ring
+static void test_typed(unsigned int cap, unsigned int seed) {
+    struct rec buf[MAXCAP];
+    struct rec in[2 * MAXCAP];
+    struct rec out[2 * MAXCAP];
+    struct rec a, b;
+    struct rec *p;
+    struct rec_ring r;
+    struct rec_model m;
+    unsigned int n, got, i, step;
+    unsigned int seq = 0;
+    int ra, rb;
+
+    srand(seed);
+    m.len = 0;
+    m.cap = cap;
+    CHECK(rec_ring_init(&r, buf, cap) == 0, "typed init %u refused", cap);
+    r.start = r.end = 0xFFFFFFFFu - cap;
+
+    for (step = 0; step < STEPS; step++) {
+        switch (rand() % 10) {
+            case 0:
+            case 1:
+                a = rec_next(&seq);
+                rec_ring_put(&r, a);
+                rec_model_put(&m, a);
+                break;
+
+            case 2:
+                a = rec_next(&seq);
+                ra = rec_ring_push(&r, a);
+                rb = (m.len == m.cap) ? -1 : 0;
+                if (rb == 0) {
+                    rec_model_put(&m, a);
+                }
+                CHECK(ra == rb, "typed push %d, model %d (step %u)", ra, rb, step);
+                break;
+
+            case 3:
+            case 4:
+                ra = rec_ring_get(&r, &a);
+                rb = (m.len == 0) ? -1 : 0;
+                if (rb == 0) {
+                    rec_model_get(&m, &b);
+                }
+                CHECK(ra == rb && (ra != 0 || rec_eq(a, b)),
+                      "typed get %d, model %d (step %u)", ra, rb, step);
+                break;
+
+            case 5:
+                n = rand() % (2 * cap + 1);
+                for (i = 0; i < n; i++) {
+                    in[i] = rec_next(&seq);
+                    rec_model_put(&m, in[i]);
+                }
+                rec_ring_put_n(&r, in, n);
+                break;
+
+            case 6:
+                n = rand() % (2 * cap + 1);
+                got = rec_ring_get_n(&r, out, n);
+                CHECK(got == (n < m.len ? n : m.len), "typed get_n %u of %u", got, n);
+                for (i = 0; i < got; i++) {
+                    rec_model_get(&m, &b);
+                    CHECK(rec_eq(out[i], b), "typed get_n element %u (step %u)", i, step);
+                }
+                break;
+
+            case 7:
+                n = rand() % (cap + 1);
+                got = rec_ring_reserve(&r, &p, n);
+                CHECK(got <= n && got <= cap - m.len, "typed reserve %u of %u", got, n);
+                CHECK(p >= buf && p + got <= buf + cap, "typed reserve out of bounds");
+                got = got ? rand() % (got + 1) : 0;
+                for (i = 0; i < got; i++) {
+                    p[i] = rec_next(&seq);
+                    rec_model_put(&m, p[i]);
+                }
+                rec_ring_commit(&r, got);
+                break;
+
+            case 8:
+                got = rec_ring_peek(&r, &p);
+                CHECK(got <= m.len && (m.len == 0 || got > 0), "typed peek %u of %u", got, m.len);
+                for (i = 0; i < got; i++) {
+                    CHECK(rec_eq(p[i], m.data[i]), "typed peek element %u (step %u)", i, step);
+                }
+                n = rand() % (cap + 1);
+                got = rec_ring_consume(&r, n);
+                CHECK(got == (n < m.len ? n : m.len), "typed consume %u of %u", got, n);
+                for (i = 0; i < got; i++) {
+                    rec_model_get(&m, &b);
+                }
+                break;
+
+            case 9:
+                if (rand() % 50 == 0) {
+                    rec_ring_reset(&r);
+                    m.len = 0;
+                }
+                break;
+        }
+
+        CHECK(rec_same(&r, &m), "typed contents differ at step %u (cap %u)", step, cap);
+    }
+}
+
+int main(void) {
+    unsigned int cap;
+
+    test_init();
+    for (cap = 1; cap <= MAXCAP; cap <<= 1) {
+        test_random(cap, cap * 7919);
+        test_typed(cap, cap * 104729);
+    }
+
+    if (failures > 0) {
+        printf("ring_test: %d failures\n", failures);
+        return 1;
+    }
+
+    printf("ring_test: ok\n");
+    return 0;
+}
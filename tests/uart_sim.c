@@ -0,0 +1,516 @@
+// Simulated UARTs, BDMA channels, interrupt controller and TIMER5
+// See uart_sim.h
+//
+// Time is counted in MCLK cycles. It moves on by SIM_ACCESS cycles on
+// every register access, and by SIM_TICK cycles on every SIGALRM, so
+// the main code keeps the simulation going whether it polls registers
+// or spins on memory waiting for an ISR. Interrupts are taken right
+// before a register access, or on SIGALRM, so latency stays within a
+// few accesses however fast the host runs.
+//
+// Model, close enough to the S3C44B0X for the firmware to notice:
+// - UART: 8N1 frames of 16 * (UBRDIV + 1) * 10 cycles, 1-byte holding
+//   registers or 16-byte FIFOs, internal loopback (UCON[5]). Port 0
+//   output goes to stdout when not looped back. Rx interrupts are
+//   pulses (on each byte, or at the FIFO trigger level, or after 3
+//   idle frames with UCON[7]), Tx interrupts are levels.
+// - BDMA: one unit transfer per UART request, terminal count interrupt
+//   (ICNT[23:22] = 11) and auto-reload (ICNT[21]).
+// - TIMER5: the count is loaded when the timer starts, and every
+//   reload raises INT_TIMER5.
+// - Interrupt controller: IRQ only, the highest pending line first.
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "uart_sim.h"
+
+// Cycles per register access, and per SIGALRM (every SIM_TICK_US)
+#define SIM_ACCESS 4
+#define SIM_TICK 640
+#define SIM_TICK_US 10
+
+#define FIFO_DEPTH 16
+// ISRs run per SIGALRM, at most (a stuck level line can't hang us)
+#define MAX_DISPATCH 64
+
+#define INT_UTXD(p) ((p) ? 2 : 3)
+#define INT_URXD(p) ((p) ? 6 : 7)
+#define INT_TIMER5 8
+#define INT_UERR01 14
+#define INT_BDMA(c) ((c) ? 16 : 17)
+#define INT_GLOBAL 26
+
+// Register cells, per port and per BDMA channel
+#define UREG(p, r) regs[SIM_ULCON0 + 8 * (p) + (r)]
+#define ULCON 0
+#define UCON 1
+#define UFCON 2
+#define UTRSTAT 4
+#define UERSTAT 5
+#define UFSTAT 6
+#define UBRDIV 7
+
+#define BREG(c, r) regs[SIM_BDCON0 + 5 * (c) + (r)]
+#define BDISRC 1
+#define BDIDES 2
+#define BDICNT 3
+#define BDCDES 4
+
+struct sim_fifo {
+    unsigned char b[FIFO_DEPTH];
+    int r;
+    int n;
+};
+
+struct sim_port {
+    struct sim_fifo tx;
+    struct sim_fifo rx;
+    // Byte in the transmit shifter, and when it's out
+    int shifting;
+    unsigned char shift;
+    unsigned long long shift_end;
+    // Rx time out: last arrival, and if it already fired since
+    unsigned long long last_rx;
+    int timeout_raised;
+    // Sticky error bits, cleared by reading UERSTAT
+    unsigned int errors;
+};
+
+struct sim_bdma {
+    int on;
+    unsigned int src;
+    unsigned int dst;
+    unsigned int cnt;
+};
+
+static volatile unsigned regs[SIM_NREGS];
+unsigned sim_isr[27];
+unsigned int sim_tx_overruns;
+
+static unsigned long long now;
+static struct sim_port ports[2];
+static struct sim_bdma bdma[2];
+static unsigned int pend;
+
+static int t5_on;
+static unsigned int t5_cnt;
+static unsigned long long t5_base;
+static unsigned long long t5_wraps;
+
+// Set while the model is being updated, SIGALRM skips its tick then
+static volatile sig_atomic_t busy;
+// Set while ISRs run, they don't nest
+static volatile sig_atomic_t in_isr;
+
+static void fifo_push(struct sim_fifo *f, unsigned char c) {
+    f->b[(f->r + f->n) % FIFO_DEPTH] = c;
+    f->n++;
+}
+
+static unsigned char fifo_pop(struct sim_fifo *f) {
+    unsigned char c = f->b[f->r];
+
+    f->r = (f->r + 1) % FIFO_DEPTH;
+    f->n--;
+    return c;
+}
+
+static void raise_line(int line) {
+    pend |= 1u << line;
+}
+
+static int fifo_on(int p) {
+    return UREG(p, UFCON) & 0x1;
+}
+
+static int depth(int p) {
+    return fifo_on(p) ? FIFO_DEPTH : 1;
+}
+
+static unsigned long long frame_cycles(int p) {
+    return 16ULL * ((UREG(p, UBRDIV) & 0xFFFF) + 1) * 10;
+}
+
+static int rx_trig(int p) {
+    static const int trig[] = {4, 8, 12, 16};
+
+    return trig[(UREG(p, UFCON) >> 4) & 0x3];
+}
+
+static int tx_trig(int p) {
+    static const int trig[] = {0, 4, 8, 12};
+
+    return trig[(UREG(p, UFCON) >> 6) & 0x3];
+}
+
+static unsigned char *mem(unsigned int addr) {
+    return (unsigned char *) (uintptr_t) (addr & 0x0FFFFFFF);
+}
+
+// A byte arrives at the receiver of port `p`
+static void rx_arrive(int p, unsigned char c) {
+    struct sim_port *pt = &ports[p];
+    unsigned int ucon = UREG(p, UCON);
+
+    // Receiver off
+    if ((ucon & 0x3) == 0) {
+        return;
+    }
+
+    if (pt->rx.n == depth(p)) {
+        // Overrun, UERSTAT[0]
+        pt->errors |= 0x1;
+        if (ucon & (0x1 << 6)) {
+            raise_line(INT_UERR01);
+        }
+        return;
+    }
+
+    fifo_push(&pt->rx, c);
+    pt->last_rx = now;
+    pt->timeout_raised = 0;
+
+    if ((ucon & 0x3) == 0x1 && (!fifo_on(p) || pt->rx.n >= rx_trig(p))) {
+        raise_line(INT_URXD(p));
+    }
+}
+
+// Put `c` in the Tx holding register/FIFO of port `p`
+static void tx_put(int p, unsigned char c) {
+    struct sim_port *pt = &ports[p];
+
+    if (pt->tx.n == depth(p)) {
+        sim_tx_overruns++;
+        return;
+    }
+
+    fifo_push(&pt->tx, c);
+    if (!pt->shifting) {
+        pt->shift = fifo_pop(&pt->tx);
+        pt->shifting = 1;
+        pt->shift_end = now + frame_cycles(p);
+    }
+}
+
+static void port_update(int p) {
+    struct sim_port *pt = &ports[p];
+    unsigned int ucon = UREG(p, UCON);
+    unsigned int ufcon = UREG(p, UFCON);
+
+    // FIFO resets, auto-cleared
+    if (ufcon & 0x6) {
+        if (ufcon & 0x2) {
+            pt->rx.n = 0;
+        }
+        if (ufcon & 0x4) {
+            pt->tx.n = 0;
+        }
+        UREG(p, UFCON) = ufcon & ~0x6;
+    }
+
+    while (pt->shifting && now >= pt->shift_end) {
+        if (ucon & (0x1 << 5)) {
+            rx_arrive(p, pt->shift);
+        } else if (p == 0) {
+            // write() is safe from the SIGALRM handler, stdio isn't
+            if (write(1, &pt->shift, 1) < 0) {
+                // Nowhere to report it
+            }
+        }
+
+        if (pt->tx.n > 0) {
+            pt->shift = fifo_pop(&pt->tx);
+            pt->shift_end += frame_cycles(p);
+        } else {
+            pt->shifting = 0;
+        }
+    }
+
+    // Rx time out, with bytes sitting below the trigger level
+    if ((ucon & 0x3) == 0x1 && fifo_on(p) && (ucon & (0x1 << 7)) &&
+        pt->rx.n > 0 && !pt->timeout_raised &&
+        now - pt->last_rx >= 3 * frame_cycles(p)) {
+        pt->timeout_raised = 1;
+        raise_line(INT_URXD(p));
+    }
+}
+
+// Tx interrupts are levels, raised for as long as there's room
+static void port_levels(int p) {
+    struct sim_port *pt = &ports[p];
+    unsigned int stat;
+
+    if (((UREG(p, UCON) >> 2) & 0x3) == 0x1) {
+        if (fifo_on(p) ? pt->tx.n <= tx_trig(p) : pt->tx.n == 0) {
+            raise_line(INT_UTXD(p));
+        }
+    }
+
+    stat = 0;
+    if (pt->rx.n > 0) {
+        stat |= 0x1;
+    }
+    if (pt->tx.n == 0) {
+        stat |= 0x2;
+        if (!pt->shifting) {
+            stat |= 0x4;
+        }
+    }
+    UREG(p, UTRSTAT) = stat;
+
+    stat = (pt->rx.n & 0xF) | ((pt->tx.n & 0xF) << 4);
+    if (pt->rx.n == FIFO_DEPTH) {
+        stat = (stat & ~0xF) | (0x1 << 8);
+    }
+    if (pt->tx.n == FIFO_DEPTH) {
+        stat = (stat & ~0xF0) | (0x1 << 9);
+    }
+    UREG(p, UFSTAT) = stat;
+}
+
+// BDMA channel `c` serves port `c`
+static void bdma_update(int c) {
+    struct sim_bdma *ch = &bdma[c];
+    struct sim_port *pt = &ports[c];
+    unsigned int icnt = BREG(c, BDICNT);
+    unsigned int ucon = UREG(c, UCON);
+    int txreq = ((ucon >> 2) & 0x3) == (unsigned int) (2 + c);
+    int rxreq = (ucon & 0x3) == (unsigned int) (2 + c);
+    int moved;
+
+    if ((icnt & (0x1 << 20)) && !ch->on) {
+        ch->on = 1;
+        ch->src = BREG(c, BDISRC) & 0x0FFFFFFF;
+        ch->dst = BREG(c, BDIDES) & 0x0FFFFFFF;
+        ch->cnt = icnt & 0xFFFFF;
+    } else if (!(icnt & (0x1 << 20))) {
+        ch->on = 0;
+    }
+
+    if (!ch->on) {
+        return;
+    }
+
+    // Rx requests wait for the FIFO trigger level
+    if (rxreq && fifo_on(c) && pt->rx.n < rx_trig(c)) {
+        rxreq = 0;
+    }
+
+    moved = 0;
+    while (ch->cnt > 0) {
+        if (txreq && pt->tx.n < depth(c)) {
+            tx_put(c, *mem(ch->src));
+            ch->src++;
+        } else if (rxreq && pt->rx.n > 0) {
+            *mem(ch->dst) = fifo_pop(&pt->rx);
+            ch->dst++;
+        } else {
+            break;
+        }
+        ch->cnt--;
+        moved++;
+    }
+
+    if (moved > 0 && ch->cnt == 0) {
+        if (((icnt >> 22) & 0x3) == 0x3) {
+            raise_line(INT_BDMA(c));
+        }
+
+        if (icnt & (0x1 << 21)) {
+            ch->src = BREG(c, BDISRC) & 0x0FFFFFFF;
+            ch->dst = BREG(c, BDIDES) & 0x0FFFFFFF;
+            ch->cnt = icnt & 0xFFFFF;
+        } else {
+            ch->on = 0;
+            BREG(c, BDICNT) = icnt & ~(0x1 << 20);
+        }
+    }
+
+    BREG(c, BDCDES) = ch->dst;
+}
+
+static void timer5_update(void) {
+    unsigned int tcon = regs[SIM_TCON];
+    unsigned long long scale;
+    unsigned long long ticks;
+    unsigned long long wraps;
+
+    if ((tcon & (0x1 << 24)) && !t5_on) {
+        t5_on = 1;
+        t5_cnt = regs[SIM_TCNTB5] & 0xFFFF;
+        t5_base = now;
+        t5_wraps = 0;
+    } else if (!(tcon & (0x1 << 24))) {
+        t5_on = 0;
+    }
+
+    if (!t5_on) {
+        return;
+    }
+
+    scale = (((regs[SIM_TCFG0] >> 16) & 0xFF) + 1)
+            * (2ULL << ((regs[SIM_TCFG1] >> 20) & 0xF));
+    ticks = (now - t5_base) / scale;
+    wraps = ticks / (t5_cnt + 1);
+    if (wraps > t5_wraps) {
+        t5_wraps = wraps;
+        raise_line(INT_TIMER5);
+    }
+
+    regs[SIM_TCNTO5] = t5_cnt - (unsigned int) (ticks % (t5_cnt + 1));
+}
+
+static void sim_update(void) {
+    int p;
+
+    pend &= ~(regs[SIM_I_ISPC] | regs[SIM_F_ISPC]);
+    regs[SIM_I_ISPC] = 0;
+    regs[SIM_F_ISPC] = 0;
+
+    timer5_update();
+    for (p = 0; p < 2; p++) {
+        port_update(p);
+        bdma_update(p);
+        port_levels(p);
+    }
+
+    regs[SIM_INTPND] = pend;
+}
+
+// The IRQ line: run the ISRs of every pending, unmasked line
+// ISRs don't nest, and SIGALRM is blocked while its handler runs them.
+static void sim_dispatch(void) {
+    int i;
+    int line;
+    unsigned int ready;
+
+    if (in_isr) {
+        return;
+    }
+    in_isr = 1;
+
+    for (i = 0; i < MAX_DISPATCH; i++) {
+        if ((regs[SIM_INTCON] & 0x2) || (regs[SIM_INTMSK] & (1u << INT_GLOBAL))) {
+            break;
+        }
+
+        ready = pend & ~regs[SIM_INTMSK] & ~regs[SIM_INTMOD] & 0x3FFFFFF;
+        if (ready == 0) {
+            break;
+        }
+
+        for (line = 25; !(ready & (1u << line)); line--);
+
+        if (sim_isr[line] == 0) {
+            pend &= ~(1u << line);
+            continue;
+        }
+
+        ((void (*)(void)) (uintptr_t) sim_isr[line])();
+
+        busy = 1;
+        sim_update();
+        busy = 0;
+    }
+
+    in_isr = 0;
+}
+
+// Every access takes SIM_ACCESS cycles, and pending interrupts are taken
+// before it, so the value read can't go stale under a read-modify-write
+static void sim_access(void) {
+    busy = 1;
+    now += SIM_ACCESS;
+    sim_update();
+    busy = 0;
+
+    sim_dispatch();
+}
+
+volatile unsigned *sim_reg(enum sim_reg_id r) {
+    int p;
+
+    sim_access();
+
+    // Reading UERSTATn clears it
+    if (r == SIM_UERSTAT0 || r == SIM_UERSTAT1) {
+        busy = 1;
+        p = (r == SIM_UERSTAT1);
+        regs[r] = ports[p].errors;
+        ports[p].errors = 0;
+        busy = 0;
+    }
+
+    return &regs[r];
+}
+
+void sim_write_utxh(int port, unsigned char c) {
+    sim_access();
+
+    busy = 1;
+    tx_put(port, c);
+    port_levels(port);
+    busy = 0;
+}
+
+unsigned char sim_read_urxh(int port) {
+    unsigned char c = 0;
+
+    sim_access();
+
+    busy = 1;
+    if (ports[port].rx.n > 0) {
+        c = fifo_pop(&ports[port].rx);
+    }
+    port_levels(port);
+    busy = 0;
+
+    return c;
+}
+
+// Keeps time going while the main code spins on memory only
+static void sim_irq(int sig) {
+    (void) sig;
+
+    if (busy || in_isr) {
+        return;
+    }
+
+    busy = 1;
+    now += SIM_TICK;
+    sim_update();
+    busy = 0;
+
+    sim_dispatch();
+}
+
+void sim_start(void) {
+    struct sigaction sa;
+    struct itimerval it;
+
+    // The BDMA model needs the firmware buffers below 0x10000000
+    if ((uintptr_t) &ports > 0x0FFFFFFF) {
+        fprintf(stderr, "uart_sim: static data above 0x10000000, build with -no-pie\n");
+        exit(2);
+    }
+
+    sa.sa_handler = sim_irq;
+    sigfillset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &sa, NULL);
+
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = SIM_TICK_US;
+    it.it_value = it.it_interval;
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+void sim_stop(void) {
+    struct itimerval it = {{0, 0}, {0, 0}};
+
+    setitimer(ITIMER_REAL, &it, NULL);
+}
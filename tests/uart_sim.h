@@ -0,0 +1,145 @@
+// Simulated S3C44B0X register block, for the host build of uart.c
+//
+// Force-included (-include uart_sim.h) ahead of every firmware source.
+// It defines the 44b.h include guard, so the real register map is
+// skipped, and every register the UART, BDMA, interrupt controller and
+// timer code touches becomes a cell of the simulator. Each access goes
+// through sim_reg(), which advances the simulated time and brings the
+// UARTs, the BDMA channels and TIMER5 up to date.
+//
+// Interrupts are taken before any register access, or from a SIGALRM
+// handler when the main code spins on memory, so the ISRs preempt it
+// like on the board.
+// Static data must sit below 0x10000000 (build with -no-pie): the
+// firmware hands 28-bit addresses to the BDMA channels.
+
+#ifndef UART_SIM_H_
+#define UART_SIM_H_
+
+#define __44B_H__
+
+enum enable {
+    DISABLE = 0,
+    ENABLE = 1
+};
+
+#define MCLK 64000000
+
+// The ARM IRQ attribute means nothing here, the handlers are plain calls
+#define interrupt(x) used
+
+enum sim_reg_id {
+    SIM_ULCON0, SIM_UCON0, SIM_UFCON0, SIM_UMCON0, SIM_UTRSTAT0,
+    SIM_UERSTAT0, SIM_UFSTAT0, SIM_UBRDIV0,
+    SIM_ULCON1, SIM_UCON1, SIM_UFCON1, SIM_UMCON1, SIM_UTRSTAT1,
+    SIM_UERSTAT1, SIM_UFSTAT1, SIM_UBRDIV1,
+    SIM_BDCON0, SIM_BDISRC0, SIM_BDIDES0, SIM_BDICNT0, SIM_BDCDES0,
+    SIM_BDCON1, SIM_BDISRC1, SIM_BDIDES1, SIM_BDICNT1, SIM_BDCDES1,
+    SIM_INTCON, SIM_INTPND, SIM_INTMOD, SIM_INTMSK, SIM_I_ISPC, SIM_F_ISPC,
+    SIM_TCFG0, SIM_TCFG1, SIM_TCON,
+    SIM_TCNTB0, SIM_TCMPB0, SIM_TCNTO0,
+    SIM_TCNTB1, SIM_TCMPB1, SIM_TCNTO1,
+    SIM_TCNTB2, SIM_TCMPB2, SIM_TCNTO2,
+    SIM_TCNTB3, SIM_TCMPB3, SIM_TCNTO3,
+    SIM_TCNTB4, SIM_TCMPB4, SIM_TCNTO4,
+    SIM_TCNTB5, SIM_TCNTO5,
+    SIM_PCONC, SIM_PCONE, SIM_CLKCON,
+    SIM_NREGS
+};
+
+volatile unsigned *sim_reg(enum sim_reg_id r);
+void sim_write_utxh(int port, unsigned char c);
+unsigned char sim_read_urxh(int port);
+
+// ISR vector table, indexed by interrupt line
+extern unsigned sim_isr[27];
+
+#define rULCON0     (*sim_reg(SIM_ULCON0))
+#define rUCON0      (*sim_reg(SIM_UCON0))
+#define rUFCON0     (*sim_reg(SIM_UFCON0))
+#define rUMCON0     (*sim_reg(SIM_UMCON0))
+#define rUTRSTAT0   (*sim_reg(SIM_UTRSTAT0))
+#define rUERSTAT0   (*sim_reg(SIM_UERSTAT0))
+#define rUFSTAT0    (*sim_reg(SIM_UFSTAT0))
+#define rUBRDIV0    (*sim_reg(SIM_UBRDIV0))
+#define rULCON1     (*sim_reg(SIM_ULCON1))
+#define rUCON1      (*sim_reg(SIM_UCON1))
+#define rUFCON1     (*sim_reg(SIM_UFCON1))
+#define rUMCON1     (*sim_reg(SIM_UMCON1))
+#define rUTRSTAT1   (*sim_reg(SIM_UTRSTAT1))
+#define rUERSTAT1   (*sim_reg(SIM_UERSTAT1))
+#define rUFSTAT1    (*sim_reg(SIM_UFSTAT1))
+#define rUBRDIV1    (*sim_reg(SIM_UBRDIV1))
+
+#define WrUTXH0(ch) sim_write_utxh(0, (unsigned char) (ch))
+#define WrUTXH1(ch) sim_write_utxh(1, (unsigned char) (ch))
+#define RdURXH0()   sim_read_urxh(0)
+#define RdURXH1()   sim_read_urxh(1)
+
+// Same addresses as on the board, the BDMA model decodes them
+#define UTXH0       (0x1d00020)
+#define URXH0       (0x1d00024)
+#define UTXH1       (0x1d04020)
+#define URXH1       (0x1d04024)
+
+#define rBDCON0     (*sim_reg(SIM_BDCON0))
+#define rBDISRC0    (*sim_reg(SIM_BDISRC0))
+#define rBDIDES0    (*sim_reg(SIM_BDIDES0))
+#define rBDICNT0    (*sim_reg(SIM_BDICNT0))
+#define rBDCDES0    (*sim_reg(SIM_BDCDES0))
+#define rBDCON1     (*sim_reg(SIM_BDCON1))
+#define rBDISRC1    (*sim_reg(SIM_BDISRC1))
+#define rBDIDES1    (*sim_reg(SIM_BDIDES1))
+#define rBDICNT1    (*sim_reg(SIM_BDICNT1))
+#define rBDCDES1    (*sim_reg(SIM_BDCDES1))
+
+#define rINTCON     (*sim_reg(SIM_INTCON))
+#define rINTPND     (*sim_reg(SIM_INTPND))
+#define rINTMOD     (*sim_reg(SIM_INTMOD))
+#define rINTMSK     (*sim_reg(SIM_INTMSK))
+#define rI_ISPC     (*sim_reg(SIM_I_ISPC))
+#define rF_ISPC     (*sim_reg(SIM_F_ISPC))
+
+#define rTCFG0      (*sim_reg(SIM_TCFG0))
+#define rTCFG1      (*sim_reg(SIM_TCFG1))
+#define rTCON       (*sim_reg(SIM_TCON))
+#define rTCNTB0     (*sim_reg(SIM_TCNTB0))
+#define rTCMPB0     (*sim_reg(SIM_TCMPB0))
+#define rTCNTO0     (*sim_reg(SIM_TCNTO0))
+#define rTCNTB1     (*sim_reg(SIM_TCNTB1))
+#define rTCMPB1     (*sim_reg(SIM_TCMPB1))
+#define rTCNTO1     (*sim_reg(SIM_TCNTO1))
+#define rTCNTB2     (*sim_reg(SIM_TCNTB2))
+#define rTCMPB2     (*sim_reg(SIM_TCMPB2))
+#define rTCNTO2     (*sim_reg(SIM_TCNTO2))
+#define rTCNTB3     (*sim_reg(SIM_TCNTB3))
+#define rTCMPB3     (*sim_reg(SIM_TCMPB3))
+#define rTCNTO3     (*sim_reg(SIM_TCNTO3))
+#define rTCNTB4     (*sim_reg(SIM_TCNTB4))
+#define rTCMPB4     (*sim_reg(SIM_TCMPB4))
+#define rTCNTO4     (*sim_reg(SIM_TCNTO4))
+#define rTCNTB5     (*sim_reg(SIM_TCNTB5))
+#define rTCNTO5     (*sim_reg(SIM_TCNTO5))
+
+#define rPCONC      (*sim_reg(SIM_PCONC))
+#define rPCONE      (*sim_reg(SIM_PCONE))
+// IDLE (CLKCON[2]) is not modelled, sleep_idle() returns at once
+#define rCLKCON     (*sim_reg(SIM_CLKCON))
+
+#define pISR_UTXD1  (sim_isr[2])
+#define pISR_UTXD0  (sim_isr[3])
+#define pISR_URXD1  (sim_isr[6])
+#define pISR_URXD0  (sim_isr[7])
+#define pISR_TIMER5 (sim_isr[8])
+#define pISR_TIMER4 (sim_isr[9])
+#define pISR_UERR01 (sim_isr[14])
+#define pISR_BDMA1  (sim_isr[16])
+#define pISR_BDMA0  (sim_isr[17])
+
+// Start delivering interrupts, and stop
+void sim_start(void);
+void sim_stop(void);
+// Bytes written to a full Tx holding register/FIFO (firmware bugs)
+extern unsigned int sim_tx_overruns;
+
+#endif